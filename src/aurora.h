@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include<cglm/cglm.h>
 #include <cglm/struct.h>
 
@@ -11,9 +12,63 @@ typedef struct {
 	vec3s color;
 } Vertex;
 
+/**
+ * One leaf rectangle for the instanced draw path, the vertex shader expands it into four corners.
+ */
+typedef struct {
+	vec2s position;
+	vec2s size;
+	vec3s color;
+} RectInstance;
+
+typedef enum {
+	AURORA_INDEX_WIDTH_AUTO,
+	AURORA_INDEX_WIDTH_16,
+	AURORA_INDEX_WIDTH_32
+} AuroraIndexWidth;
+
+/**
+ * Timings of a single frame. The cpu parts are measured around the matching calls in the draw loop,
+ * the gpu time comes from timestamps written around the render pass (has_gpu_time is false when the
+ * graphics queue cannot write timestamps). The pipeline statistics are only filled in when they were
+ * enabled with aurora_config_enable_pipeline_statistics and the device supports them.
+ */
+typedef struct {
+	uint64_t frame;
+	double fence_wait_ms;
+	double acquire_ms;
+	double record_ms;
+	double submit_present_ms;
+	double gpu_ms;
+	bool has_gpu_time;
+	bool has_pipeline_statistics;
+	uint64_t input_assembly_vertices;
+	uint64_t input_assembly_primitives;
+	uint64_t vertex_shader_invocations;
+	uint64_t clipping_primitives;
+	uint64_t fragment_shader_invocations;
+} AuroraFrameStats;
+
+/**
+ * The preferred way of presenting. Unsupported modes fall back: MAILBOX to IMMEDIATE, IMMEDIATE to MAILBOX,
+ * and all of them finally to FIFO, which every device supports.
+ */
+typedef enum {
+	AURORA_PRESENT_MODE_FIFO,
+	AURORA_PRESENT_MODE_FIFO_RELAXED,
+	AURORA_PRESENT_MODE_MAILBOX,
+	AURORA_PRESENT_MODE_IMMEDIATE
+} AuroraPresentMode;
+
 typedef struct AuroraConfig AuroraConfig;
 typedef struct AuroraSession AuroraSession;
 
+/**
+ * Called once per iteration of the draw loop, after the window events were handled and before the frame is drawn.
+ * This is where an application reads frame stats, moves the view or requests a redraw.
+ */
+typedef void (*AuroraFrameCallback)(AuroraSession *session, void *user_data);
+
 
 void mouse_clicked(AuroraSession *session, double x, double y);
 extern AuroraConfig *aurora_config_create();
@@ -22,8 +77,28 @@ extern void aurora_config_destroy(AuroraConfig *config);
 extern void aurora_config_set_window_size(AuroraConfig *config, int width, int height);
 extern void aurora_config_set_window_allow_resize(AuroraConfig *config, bool allow_resize);
 extern void aurora_config_enable_default_validation_layers(AuroraConfig *config);
+extern void aurora_config_enable_instanced_rendering(AuroraConfig *config);
+extern void aurora_config_set_index_width(AuroraConfig *config, AuroraIndexWidth index_width);
+extern void aurora_config_enable_headless(AuroraConfig *config, int frame_count);
+extern void aurora_config_enable_pipeline_statistics(AuroraConfig *config);
+extern void aurora_config_set_pipeline_cache_path(AuroraConfig *config, char *path);
+extern void aurora_config_set_frames_in_flight(AuroraConfig *config, int frames_in_flight);
+extern void aurora_config_set_swapchain_image_count(AuroraConfig *config, int image_count);
+extern void aurora_config_set_present_mode(AuroraConfig *config, AuroraPresentMode present_mode);
+extern void aurora_config_enable_on_demand_rendering(AuroraConfig *config);
+extern void aurora_config_enable_dynamic_rendering(AuroraConfig *config);
+extern void aurora_config_enable_damage_rendering(AuroraConfig *config);
+extern void aurora_config_enable_compact_vertices(AuroraConfig *config);
+extern void aurora_config_set_shaders(AuroraConfig *config, char *vertex_shader_path, char *fragment_shader_path);
 extern void aurora_config_set_application_name(AuroraConfig *config, char *name);
 
+extern AuroraSession *aurora_session_create(AuroraConfig *config);
+extern void aurora_session_set_frame_callback(AuroraSession *session, AuroraFrameCallback callback, void *user_data);
+extern void aurora_session_run(AuroraSession *session);
+extern void aurora_session_destroy(AuroraSession *session);
 extern void aurora_session_start(AuroraConfig *config);
+extern size_t aurora_session_get_frame_stats(AuroraSession *session, AuroraFrameStats *stats, size_t max_count);
+extern void aurora_request_redraw(AuroraSession *session);
+extern void aurora_session_set_view(AuroraSession *session, float x, float y, float width, float height);
 
 #endif
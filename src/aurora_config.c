@@ -12,6 +12,21 @@ AuroraConfig *aurora_config_create(){
         .width = 800,
         .height = 600,
         .application_name = "Application name",
+        .instanced = false,
+        .index_width = AURORA_INDEX_WIDTH_AUTO,
+        .headless = false,
+        .headless_frame_count = 0,
+        .pipeline_statistics = false,
+        .pipeline_cache_path = NULL,
+        .frames_in_flight = 2,
+        .swapchain_image_count = 0,
+        .present_mode = AURORA_PRESENT_MODE_FIFO,
+        .on_demand = false,
+        .dynamic_rendering = false,
+        .damage_rendering = false,
+        .compact_vertices = false,
+        .vertex_shader = NULL,
+        .fragment_shader = NULL,
     };
     return config;
 }
@@ -33,6 +48,91 @@ void aurora_config_enable_default_validation_layers(AuroraConfig *config){
 	config->enable_validation_layers = true;
 }
 
+void aurora_config_enable_instanced_rendering(AuroraConfig *config){
+	config->instanced = true;
+}
+
+void aurora_config_set_index_width(AuroraConfig *config, AuroraIndexWidth index_width){
+	config->index_width = index_width;
+}
+
+/**
+ * Renders frame_count frames into an offscreen image instead of opening a window, no display is needed.
+ */
+void aurora_config_enable_headless(AuroraConfig *config, int frame_count){
+	config->headless = true;
+	config->headless_frame_count = frame_count;
+}
+
+void aurora_config_enable_pipeline_statistics(AuroraConfig *config){
+	config->pipeline_statistics = true;
+}
+
+/**
+ * Where compiled pipelines are kept between runs. NULL, the default, disables the cache file.
+ */
+void aurora_config_set_pipeline_cache_path(AuroraConfig *config, char *path){
+	config->pipeline_cache_path = path;
+}
+
+/**
+ * 1 gives the lowest latency, as the cpu never runs ahead of the gpu, up to 4 gives the most throughput.
+ */
+void aurora_config_set_frames_in_flight(AuroraConfig *config, int frames_in_flight){
+	config->frames_in_flight = frames_in_flight;
+}
+
+/**
+ * Clamped to what the surface supports, 0 asks for one more than the minimum.
+ */
+void aurora_config_set_swapchain_image_count(AuroraConfig *config, int image_count){
+	config->swapchain_image_count = image_count;
+}
+
+void aurora_config_set_present_mode(AuroraConfig *config, AuroraPresentMode present_mode){
+	config->present_mode = present_mode;
+}
+
+/**
+ * Sleeps until an event arrives and only draws when the tree, the window size or aurora_request_redraw
+ * changed something, instead of drawing as fast as the present mode allows.
+ */
+void aurora_config_enable_on_demand_rendering(AuroraConfig *config){
+	config->on_demand = true;
+}
+
+/**
+ * Draws straight into the swapchain image views without a render pass or framebuffers. Needs Vulkan 1.3,
+ * other devices keep using the render pass.
+ */
+void aurora_config_enable_dynamic_rendering(AuroraConfig *config){
+	config->dynamic_rendering = true;
+}
+
+/**
+ * Keeps what was drawn into every image and after a split only redraws the rectangles that changed,
+ * which are also handed to the compositor when VK_KHR_incremental_present is available.
+ */
+void aurora_config_enable_damage_rendering(AuroraConfig *config){
+	config->damage_rendering = true;
+}
+
+/**
+ * Stores vertices on the gpu as 16 bit pixel positions and 8 bit colors, 8 bytes instead of 20. The layout then
+ * has to fit in 65535 by 65535 pixels. Has no effect on instanced rendering.
+ */
+void aurora_config_enable_compact_vertices(AuroraConfig *config){
+	config->compact_vertices = true;
+}
+
+/**
+ * Loads SPIR-V modules from these files instead of the ones built into the library, NULL keeps the built in one.
+ */
+void aurora_config_set_shaders(AuroraConfig *config, char *vertex_shader_path, char *fragment_shader_path){
+	config->vertex_shader = vertex_shader_path;
+	config->fragment_shader = fragment_shader_path;
+}
+
 void aurora_config_set_application_name(AuroraConfig *config, char* name){
 	config->application_name = name;
 }
@@ -2,11 +2,14 @@
 #include "aurora_vulkan.h"
 #include "aurora_tree.h"
 
+#include <time.h>
+
 void window_resize_callback(GLFWwindow *window, int width, int height){
-    (void)window;
-	width = width;
-	height = height;
-	// resized = true;
+    (void)width;
+    (void)height;
+	AuroraSession *session = (AuroraSession*)glfwGetWindowUserPointer(window);
+	session->resized = true;
+	session->redraw = true;
 }
 
 void mouse_click_callback(GLFWwindow *window, int button, int action, int mods){
@@ -15,29 +18,130 @@ void mouse_click_callback(GLFWwindow *window, int button, int action, int mods){
 		double x, y;
 		glfwGetCursorPos(window, &x, &y);
         AuroraSession *session = (AuroraSession*)glfwGetWindowUserPointer(window);
+        // the cursor is in window coordinates, the view decides which part of the layout is under it
+        int width, height;
+        glfwGetWindowSize(window, &width, &height);
+        x = session->view_x + x / width * session->view_width;
+        y = session->view_y + y / height * session->view_height;
         split_node(session->tree, find_at(session->tree, (int)x, (int)y), (int)x, (int)y);
-        size_t vertex_count;
-        size_t index_count;
-        Vertex *vertices;
-        uint16_t *indices;
-        get_draw_data(session->tree, &vertices, &vertex_count, &indices, &index_count);
-        recreate_vertices(session->vk_session, vertices, vertex_count, indices, index_count);
+        size_t patch_count;
+        if(session->vk_session->instanced){
+            LeafPatch *patches = get_instance_patches(session->tree, &patch_count);
+            patch_instances(session->vk_session, patches, patch_count, get_leaf_count(session->tree));
+        }else{
+            LeafPatch *patches = get_draw_patches(session->tree, &patch_count);
+            patch_vertices(session->vk_session, patches, patch_count, get_leaf_count(session->tree));
+        }
+        session->redraw = true;
 	}
 }
 
+void window_refresh_callback(GLFWwindow *window){
+	AuroraSession *session = (AuroraSession*)glfwGetWindowUserPointer(window);
+	// whatever was covered may not have been kept
+	vulkan_session_damage_all(session->vk_session);
+	session->redraw = true;
+}
 
+/**
+ * Marks the window as needing a new frame. With on demand rendering this is the only way to get one drawn
+ * without the tree or the window changing, it also wakes the loop up when it is waiting for events.
+ */
+void aurora_request_redraw(AuroraSession *session){
+	session->redraw = true;
+	if(!session->headless){
+		glfwPostEmptyEvent();
+	}
+}
 
-void aurora_session_start(AuroraConfig *config){
-    glfwInit();
+/**
+ * Shows the part of the layout at x, y of width by height pixels in the whole window, so panning and zooming
+ * are just a different rectangle. The geometry is neither rebuilt nor uploaded again.
+ */
+void aurora_session_set_view(AuroraSession *session, float x, float y, float width, float height){
+	session->view_x = x;
+	session->view_y = y;
+	session->view_width = width;
+	session->view_height = height;
+	vulkan_session_set_view(session->vk_session, x, y, width, height);
+	session->redraw = true;
+}
+
+
+
+size_t aurora_session_get_frame_stats(AuroraSession *session, AuroraFrameStats *stats, size_t max_count){
+    return vulkan_session_get_frame_stats(session->vk_session, stats, max_count);
+}
+
+void aurora_session_set_frame_callback(AuroraSession *session, AuroraFrameCallback callback, void *user_data){
+	session->frame_callback = callback;
+	session->frame_user_data = user_data;
+}
+
+static void run_frame_callback(AuroraSession *session){
+	if(session->frame_callback != NULL){
+		session->frame_callback(session, session->frame_user_data);
+	}
+}
+
+void aurora_session_run_headless(AuroraSession *aurora, int frame_count){
+    VkSession *session = aurora->vk_session;
+    struct timespec start, end;
+    timespec_get(&start, TIME_UTC);
+    for(int i = 0; i < frame_count; i++){
+        run_frame_callback(aurora);
+        vulkan_session_draw_frame(session, false);
+    }
+    vulkan_session_wait_idle(session);
+    timespec_get(&end, TIME_UTC);
+    double ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+    printf("%d frames in %.3f ms (%.1f fps)\n", frame_count, ms, ms > 0 ? frame_count * 1000.0 / ms : 0.0);
+
+    AuroraFrameStats stats[128];
+    size_t count = vulkan_session_get_frame_stats(session, stats, 128);
+    double record = 0, submit = 0, gpu = 0;
+    size_t gpu_count = 0;
+    for(size_t i = 0; i < count; i++){
+        record += stats[i].record_ms;
+        submit += stats[i].submit_present_ms;
+        if(stats[i].has_gpu_time){
+            gpu += stats[i].gpu_ms;
+            gpu_count++;
+        }
+    }
+    if(count > 0){
+        printf("last %zu frames: record %.3f ms, submit %.3f ms, gpu %.3f ms\n", count, record / count, submit / count, gpu_count > 0 ? gpu / gpu_count : 0.0);
+    }
+}
+
+/**
+ * Creates the window (unless headless), the tree and everything needed to draw it. Nothing is drawn before aurora_session_run.
+ */
+AuroraSession *aurora_session_create(AuroraConfig *config){
     uint32_t glfw_extension_count = 0;
-    const char** glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
-    Tree *tree = create_tree(800, 600);
-    size_t vertex_count;
-    size_t index_count;
-    Vertex *vertices;
-    uint16_t *indices;
-    get_draw_data(tree, &vertices, &vertex_count, &indices, &index_count);
-	VkConfig vkConfig = {
+    const char** glfw_extensions = NULL;
+    if(!config->headless){
+        glfwInit();
+        glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
+    }
+    Tree *tree = create_tree(config->width, config->height);
+    enable_spatial_index(tree);
+    size_t vertex_count = 0;
+    size_t index_count = 0;
+    size_t instance_count = 0;
+    Vertex *vertices = NULL;
+    uint32_t *indices = NULL;
+    RectInstance *instances = NULL;
+    if(config->instanced){
+        get_instance_data(tree, &instances, &instance_count);
+    }else{
+        get_draw_data(tree, &vertices, &vertex_count, &indices, &index_count);
+    }
+    AuroraSession *aurora = malloc(sizeof(AuroraSession));
+    if(aurora == NULL){
+        abort();
+    }
+	aurora->vk_config = (VkConfig){
         .enable_validation_layers = false,
         .application_name = config->application_name,
         .glfw_extension_count = glfw_extension_count,
@@ -45,20 +149,97 @@ void aurora_session_start(AuroraConfig *config){
         .vertex_count = vertex_count,
         .vertices = vertices,
         .index_count = index_count,
-        .indices = indices
+        .indices = indices,
+        .index_width = config->index_width,
+        .instanced = config->instanced,
+        .instance_count = instance_count,
+        .instances = instances,
+        .headless = config->headless,
+        .pipeline_statistics = config->pipeline_statistics,
+        .pipeline_cache_path = config->pipeline_cache_path,
+        .vertex_shader = config->vertex_shader,
+        .fragment_shader = config->fragment_shader,
+        .frames_in_flight = config->frames_in_flight,
+        .swapchain_image_count = config->swapchain_image_count,
+        .present_mode = config->present_mode,
+        .dynamic_rendering = config->dynamic_rendering,
+        .damage_rendering = config->damage_rendering,
+        .compact_vertices = config->compact_vertices,
+        .allow_resize = config->allow_resize,
+        .width = config->width,
+        .height = config->height
     };
-    VkSession *session = vulkan_session_create(&vkConfig);
-    AuroraSession *aurora = malloc(sizeof(AuroraSession));
-    aurora->vk_config = &vkConfig;
-    aurora->vk_session = session;
+    aurora->vk_session = vulkan_session_create(&aurora->vk_config);
     aurora->tree = tree;
-	glfwSetMouseButtonCallback(session->window, mouse_click_callback);
-	glfwSetWindowUserPointer(session->window, aurora);
-	glfwSetFramebufferSizeCallback(session->window, window_resize_callback);
+    aurora->on_demand = config->on_demand;
+    aurora->headless = config->headless;
+    aurora->headless_frame_count = config->headless_frame_count;
+    aurora->frame_callback = NULL;
+    aurora->frame_user_data = NULL;
+    aurora->redraw = true;
+    aurora->resized = false;
+    aurora_session_set_view(aurora, 0.0f, 0.0f, (float)tree->width, (float)tree->height);
+    if(!config->headless){
+        GLFWwindow *window = vulkan_session_get_window(aurora->vk_session);
+        glfwSetMouseButtonCallback(window, mouse_click_callback);
+        glfwSetWindowUserPointer(window, aurora);
+        glfwSetFramebufferSizeCallback(window, window_resize_callback);
+        glfwSetWindowRefreshCallback(window, window_refresh_callback);
+    }
+    return aurora;
+}
+
+/**
+ * Draws until the window is closed, or the configured number of frames when headless.
+ */
+void aurora_session_run(AuroraSession *aurora){
+    VkSession *session = aurora->vk_session;
+    if(aurora->headless){
+        aurora_session_run_headless(aurora, aurora->headless_frame_count);
+        return;
+    }
 	while(!glfwWindowShouldClose(vulkan_session_get_window(session))) {
-        glfwPollEvents();
-		vulkan_session_draw_frame(session, false);
+        if(!aurora->on_demand){
+            glfwPollEvents();
+            run_frame_callback(aurora);
+            vulkan_session_draw_frame(session, aurora->resized);
+            aurora->resized = false;
+            continue;
+        }
+        // a frame that was lost to swapchain recreation stays dirty, so it is drawn again right away
+        if(aurora->redraw){
+            glfwPollEvents();
+        }else{
+            glfwWaitEvents();
+        }
+        run_frame_callback(aurora);
+        if(aurora->redraw){
+            aurora->redraw = false;
+            if(!vulkan_session_draw_frame(session, aurora->resized)){
+                aurora->redraw = true;
+            }
+            aurora->resized = false;
+        }
+    }
+}
+
+void aurora_session_destroy(AuroraSession *aurora){
+    vulkan_session_destroy(aurora->vk_session);
+    if(!aurora->headless){
+        glfwTerminate();
     }
-    vulkan_session_destroy(session);
-	glfwTerminate();
-}
\ No newline at end of file
+    free(aurora->vk_config.vertices);
+    free(aurora->vk_config.indices);
+    free(aurora->vk_config.instances);
+    destroy_tree(aurora->tree);
+    free(aurora);
+}
+
+/**
+ * Create, run and destroy in one call, for applications that do not need the session.
+ */
+void aurora_session_start(AuroraConfig *config){
+    AuroraSession *aurora = aurora_session_create(config);
+    aurora_session_run(aurora);
+    aurora_session_destroy(aurora);
+}
@@ -12,15 +12,29 @@
 
 #include "aurora.h"
 #include "aurora_tree.h"
+#include "aurora_memory.h"
 
 struct AuroraConfig{
 	bool enable_validation_layers;
 	bool allow_resize;
+	bool instanced;
+	AuroraIndexWidth index_width;
+	bool headless;
+	int headless_frame_count;
+	bool pipeline_statistics;
+	char* pipeline_cache_path;
+	int frames_in_flight;
+	int swapchain_image_count;
+	AuroraPresentMode present_mode;
+	bool on_demand;
+	bool dynamic_rendering;
+	bool damage_rendering;
+	bool compact_vertices;
 	int width;
 	int height;
 	char* application_name;
-	char** vertex_shader;
-	char** fragment_shader;
+	char* vertex_shader;
+	char* fragment_shader;
 };
 
 typedef struct {
@@ -30,10 +44,86 @@ typedef struct {
     const char** glfw_extensions;
 	Vertex *vertices;
 	int vertex_count;
-	uint16_t *indices;
+	uint32_t *indices;
 	int index_count;
+	AuroraIndexWidth index_width;
+	bool instanced;
+	RectInstance *instances;
+	int instance_count;
+	bool headless;
+	bool pipeline_statistics;
+	char* pipeline_cache_path;
+	char* vertex_shader;
+	char* fragment_shader;
+	int frames_in_flight;
+	int swapchain_image_count;
+	AuroraPresentMode present_mode;
+	bool dynamic_rendering;
+	bool damage_rendering;
+	bool compact_vertices;
+	bool allow_resize;
+	int width;
+	int height;
 } VkConfig;
 
+/**
+ * A handle that frames already submitted may still use. Whichever handles are set get destroyed once the
+ * graphics submit numbered frame has completed, which is after every earlier submit on the queue.
+ */
+typedef struct {
+	VkBuffer buffer;
+	MemoryAllocation memory;
+	VkImageView image_view;
+	VkFramebuffer framebuffer;
+	VkCommandBuffer command_buffer;
+	VkSwapchainKHR swapchain;
+	uint64_t frame;
+} RetiredResource;
+
+/**
+ * Vertex as it is stored on the gpu with compact vertices, read as R16G16_USCALED and R8G8B8A8_UNORM
+ * so the shader still sees a float position and color.
+ */
+typedef struct {
+	uint16_t position[2];
+	uint8_t color[4];
+} CompactVertex;
+
+/**
+ * Maps layout pixels to normalized device coordinates as position * scale + offset. It is a push constant,
+ * so panning, zooming and resizing never touch the geometry.
+ */
+typedef struct {
+	vec2s scale;
+	vec2s offset;
+} ViewTransform;
+
+#define MAX_DAMAGE_RECTS 16
+
+/**
+ * The parts of an image that changed since it was last drawn (or presented). full means nothing of it can be kept,
+ * rects past MAX_DAMAGE_RECTS are merged into their bounding box.
+ */
+typedef struct {
+	VkRect2D rects[MAX_DAMAGE_RECTS];
+	uint32_t count;
+	bool full;
+} DamageRegion;
+
+#define UPLOAD_SLOTS 2
+
+/**
+ * Everything one upload needs while its copies run, so the next upload can be recorded without waiting for them.
+ */
+typedef struct {
+	VkCommandBuffer command_buffer;
+	VkFence fence;
+	VkBuffer staging_buffer;
+	MemoryAllocation staging_buffer_memory;
+	VkDeviceSize staging_capacity;
+	void *staging_data;
+} UploadSlot;
+
 typedef struct {
 	GLFWwindow *window;
 	VkInstance instance;
@@ -41,40 +131,107 @@ typedef struct {
 	VkPhysicalDevice physical_device;
 	uint32_t graphics_queue_index;
 	uint32_t present_queue_index;
+	uint32_t transfer_queue_index;
 	VkDevice logical_device;
+	MemoryAllocator *allocator;
 	VkQueue graphics_queue;
 	VkQueue present_queue;
+	VkQueue transfer_queue;
 	VkSwapchainKHR swapchain;
 	uint32_t image_count;
 	VkSurfaceFormatKHR image_format;
 	VkExtent2D image_extent;
 	VkPresentModeKHR present_mode;
+	AuroraPresentMode preferred_present_mode;
+	uint32_t requested_image_count;
+	int frames_in_flight;
 	VkSurfaceTransformFlagBitsKHR transform;
 	VkImage *images;
+	VkDeviceMemory *image_memory;
 	VkImageView *image_views;
 	VkPipelineLayout pipeline_layout;
+	ViewTransform view;
 	VkRenderPass render_pass;
+	VkRenderPass load_render_pass;
+	bool dynamic_rendering;
+	bool damage_rendering;
+	bool incremental_present;
+	bool compact_vertices;
+	DamageRegion *image_damage;
+	DamageRegion present_damage;
 	VkPipeline graphics_pipeline;
+	VkPipelineCache pipeline_cache;
+	char* pipeline_cache_path;
+	char* vertex_shader;
+	char* fragment_shader;
 	VkFramebuffer *frame_buffers;
 	VkCommandPool command_pool;
 	VkBuffer vertex_buffer;
-	VkDeviceMemory vertex_buffer_memory;
+	MemoryAllocation vertex_buffer_memory;
+	VkDeviceSize vertex_capacity;
 	VkBuffer index_buffer;
-	VkDeviceMemory index_buffer_memory;
+	MemoryAllocation index_buffer_memory;
+	VkDeviceSize index_capacity;
+	VkBufferCopy *copies;
+	size_t copy_capacity;
+	VkCommandPool transfer_command_pool;
+	UploadSlot uploads[UPLOAD_SLOTS];
+	uint32_t upload_index;
+	// the slot begin_upload opened
+	VkCommandBuffer upload_command_buffer;
+	VkBuffer staging_buffer;
+	void *staging_data;
+	VkSemaphore upload_semaphore;
+	VkSemaphore graphics_release_semaphore;
+	bool upload_pending;
+	RetiredResource *retired;
+	size_t retired_count;
+	size_t retired_capacity;
 	VkCommandBuffer *command_buffers;
+	bool *command_buffers_valid;
 	VkSemaphore *image_available_semaphores;
 	VkSemaphore *render_finished_semaphores;
 	VkFence *in_flight_fences;
+	uint64_t *frame_serials;
+	uint64_t submitted_frames;
 	Vertex *vertices;
 	int vertex_count;
-	uint16_t *indices;
+	uint32_t *indices;
 	int index_count;
+	VkIndexType index_type;
+	bool index_type_fixed;
+	bool instanced;
+	RectInstance *instances;
+	int instance_count;
+	bool headless;
+	VkQueryPool timestamp_pool;
+	VkQueryPool statistics_pool;
+	bool pipeline_statistics;
+	float timestamp_period;
+	uint64_t timestamp_mask;
+	uint64_t frame_number;
+	AuroraFrameStats *pending_stats;
+	bool *queries_pending;
+	AuroraFrameStats *frame_stats;
+	size_t frame_stats_next;
+	size_t frame_stats_count;
 } VkSession;
 
 struct AuroraSession{
-    VkConfig *vk_config;
+    VkConfig vk_config;
     VkSession *vk_session;
 	Tree *tree;
+	bool on_demand;
+	bool headless;
+	int headless_frame_count;
+	AuroraFrameCallback frame_callback;
+	void *frame_user_data;
+	bool redraw;
+	bool resized;
+	float view_x;
+	float view_y;
+	float view_width;
+	float view_height;
 };
 
 #endif
@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "aurora_memory.h"
+
+MemoryAllocator *create_memory_allocator(VkPhysicalDevice physical_device, VkDevice device) {
+    MemoryAllocator *allocator = malloc(sizeof(MemoryAllocator));
+    if (allocator == 0) { abort(); }
+    allocator->device = device;
+    vkGetPhysicalDeviceMemoryProperties(physical_device, &allocator->properties);
+    allocator->block_capacity = 4;
+    allocator->block_count = 0;
+    allocator->blocks = malloc(sizeof(MemoryBlock) * allocator->block_capacity);
+    if (allocator->blocks == 0) { abort(); }
+    return allocator;
+}
+
+static void push_offset(MemoryFreeList *list, VkDeviceSize offset) {
+    if (list->count == list->capacity) {
+        size_t new_capacity = list->capacity == 0 ? 8 : list->capacity * 2;
+        VkDeviceSize *offsets = realloc(list->offsets, sizeof(VkDeviceSize) * new_capacity);
+        if (offsets == 0) { abort(); }
+        list->offsets = offsets;
+        list->capacity = new_capacity;
+    }
+    list->offsets[list->count++] = offset;
+}
+
+static bool remove_offset(MemoryFreeList *list, VkDeviceSize offset) {
+    for (size_t i = 0; i < list->count; i++) {
+        if (list->offsets[i] == offset) {
+            list->offsets[i] = list->offsets[--list->count];
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint32_t order_of(VkDeviceSize size) {
+    uint32_t order = 0;
+    while (((VkDeviceSize)1 << (order + MEMORY_MIN_ORDER)) < size) {
+        order++;
+    }
+    return order;
+}
+
+static uint32_t find_type(MemoryAllocator *allocator, uint32_t type_filter, VkMemoryPropertyFlags properties) {
+    for (uint32_t i = 0; i < allocator->properties.memoryTypeCount; i++) {
+        if ((type_filter & (1u << i)) && (allocator->properties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+    printf("No memory type with the requested properties.\n");
+    abort();
+}
+
+static uint32_t create_block(MemoryAllocator *allocator, uint32_t memory_type, uint32_t order) {
+    // released blocks leave a hole so the block index of live allocations never changes
+    uint32_t id = UINT32_MAX;
+    for (size_t i = 0; i < allocator->block_count; i++) {
+        if (allocator->blocks[i].memory == VK_NULL_HANDLE) {
+            id = (uint32_t)i;
+            break;
+        }
+    }
+    if (id == UINT32_MAX) {
+        if (allocator->block_count == allocator->block_capacity) {
+            size_t new_capacity = allocator->block_capacity * 2;
+            MemoryBlock *blocks = realloc(allocator->blocks, sizeof(MemoryBlock) * new_capacity);
+            if (blocks == 0) { abort(); }
+            allocator->blocks = blocks;
+            allocator->block_capacity = new_capacity;
+        }
+        id = (uint32_t)allocator->block_count++;
+    }
+    uint32_t default_order = order_of(MEMORY_BLOCK_SIZE);
+    if (order < default_order) order = default_order;
+    if (order >= MEMORY_MAX_ORDERS) {
+        printf("Memory allocation too large.\n");
+        abort();
+    }
+
+    MemoryBlock *block = &allocator->blocks[id];
+    *block = (MemoryBlock){0};
+    block->size = (VkDeviceSize)1 << (order + MEMORY_MIN_ORDER);
+    block->memory_type = memory_type;
+    block->order_count = order + 1;
+    VkMemoryAllocateInfo info = {0};
+    info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    info.allocationSize = block->size;
+    info.memoryTypeIndex = memory_type;
+    if (vkAllocateMemory(allocator->device, &info, NULL, &block->memory) != VK_SUCCESS) {
+        printf("Device memory block allocation failed.\n");
+        abort();
+    }
+    // host visible blocks stay mapped for their whole lifetime
+    if ((allocator->properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0) {
+        VkResult result = vkMapMemory(allocator->device, block->memory, 0, block->size, 0, &block->mapped);
+        if (result != VK_SUCCESS) { abort(); }
+    }
+    push_offset(&block->free_lists[order], 0);
+    return id;
+}
+
+static void release_block(MemoryAllocator *allocator, MemoryBlock *block) {
+    if (block->mapped != NULL) {
+        vkUnmapMemory(allocator->device, block->memory);
+    }
+    vkFreeMemory(allocator->device, block->memory, NULL);
+    for (uint32_t i = 0; i < block->order_count; i++) {
+        free(block->free_lists[i].offsets);
+    }
+    block->memory = VK_NULL_HANDLE;
+}
+
+void destroy_memory_allocator(MemoryAllocator *allocator) {
+    for (size_t i = 0; i < allocator->block_count; i++) {
+        if (allocator->blocks[i].memory != VK_NULL_HANDLE) {
+            release_block(allocator, &allocator->blocks[i]);
+        }
+    }
+    free(allocator->blocks);
+    free(allocator);
+}
+
+static bool buddy_allocate(MemoryBlock *block, uint32_t order, VkDeviceSize *offset) {
+    uint32_t current = order;
+    while (current < block->order_count && block->free_lists[current].count == 0) {
+        current++;
+    }
+    if (current >= block->order_count) return false;
+    MemoryFreeList *list = &block->free_lists[current];
+    *offset = list->offsets[--list->count];
+    // split down to the requested size, the upper halves become free
+    while (current > order) {
+        current--;
+        push_offset(&block->free_lists[current], *offset + ((VkDeviceSize)1 << (current + MEMORY_MIN_ORDER)));
+    }
+    return true;
+}
+
+static void buddy_free(MemoryBlock *block, VkDeviceSize offset, uint32_t order) {
+    while (order + 1 < block->order_count) {
+        VkDeviceSize buddy = offset ^ ((VkDeviceSize)1 << (order + MEMORY_MIN_ORDER));
+        if (!remove_offset(&block->free_lists[order], buddy)) break;
+        if (buddy < offset) offset = buddy;
+        order++;
+    }
+    push_offset(&block->free_lists[order], offset);
+}
+
+MemoryAllocation memory_allocate(MemoryAllocator *allocator, VkMemoryRequirements requirements, VkMemoryPropertyFlags properties) {
+    uint32_t memory_type = find_type(allocator, requirements.memoryTypeBits, properties);
+    VkDeviceSize size = requirements.size > requirements.alignment ? requirements.size : requirements.alignment;
+    uint32_t order = order_of(size);
+
+    MemoryAllocation allocation = {0};
+    allocation.size = (VkDeviceSize)1 << (order + MEMORY_MIN_ORDER);
+    allocation.block = UINT32_MAX;
+    for (size_t i = 0; i < allocator->block_count; i++) {
+        MemoryBlock *block = &allocator->blocks[i];
+        if (block->memory == VK_NULL_HANDLE || block->memory_type != memory_type || order >= block->order_count) continue;
+        if (buddy_allocate(block, order, &allocation.offset)) {
+            allocation.block = (uint32_t)i;
+            break;
+        }
+    }
+    if (allocation.block == UINT32_MAX) {
+        allocation.block = create_block(allocator, memory_type, order);
+        buddy_allocate(&allocator->blocks[allocation.block], order, &allocation.offset);
+    }
+    MemoryBlock *block = &allocator->blocks[allocation.block];
+    block->used += allocation.size;
+    allocation.memory = block->memory;
+    allocation.mapped = block->mapped != NULL ? (char*)block->mapped + allocation.offset : NULL;
+    return allocation;
+}
+
+void memory_free(MemoryAllocator *allocator, MemoryAllocation *allocation) {
+    if (allocation->memory == VK_NULL_HANDLE) return;
+    MemoryBlock *block = &allocator->blocks[allocation->block];
+    buddy_free(block, allocation->offset, order_of(allocation->size));
+    block->used -= allocation->size;
+    // oversized blocks were made for a single large buffer, so they are not kept around empty
+    if (block->used == 0 && block->size > MEMORY_BLOCK_SIZE) {
+        release_block(allocator, block);
+    }
+    allocation->memory = VK_NULL_HANDLE;
+    allocation->mapped = NULL;
+}
@@ -0,0 +1,55 @@
+#ifndef AURORA_MEMORY_H
+#define AURORA_MEMORY_H
+
+#include <vulkan/vulkan.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define MEMORY_BLOCK_SIZE ((VkDeviceSize)16 * 1024 * 1024)
+#define MEMORY_MIN_ORDER 8
+#define MEMORY_MAX_ORDERS 48
+
+typedef struct {
+    VkDeviceSize *offsets;
+    size_t count;
+    size_t capacity;
+} MemoryFreeList;
+
+/**
+ * One vkAllocateMemory, handed out with a buddy scheme: every allocation is a power of two of at least
+ * 1 << MEMORY_MIN_ORDER bytes and sits at a multiple of its own size, which also satisfies any alignment
+ * up to that size. free_lists[i] holds the free ranges of 1 << (MEMORY_MIN_ORDER + i) bytes.
+ */
+typedef struct {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    uint32_t memory_type;
+    uint32_t order_count;
+    void *mapped;
+    VkDeviceSize used;
+    MemoryFreeList free_lists[MEMORY_MAX_ORDERS];
+} MemoryBlock;
+
+typedef struct {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    uint32_t block;
+    void *mapped;
+} MemoryAllocation;
+
+typedef struct {
+    VkDevice device;
+    VkPhysicalDeviceMemoryProperties properties;
+    MemoryBlock *blocks;
+    size_t block_count;
+    size_t block_capacity;
+} MemoryAllocator;
+
+extern MemoryAllocator *create_memory_allocator(VkPhysicalDevice physical_device, VkDevice device);
+extern void destroy_memory_allocator(MemoryAllocator *allocator);
+extern MemoryAllocation memory_allocate(MemoryAllocator *allocator, VkMemoryRequirements requirements, VkMemoryPropertyFlags properties);
+extern void memory_free(MemoryAllocator *allocator, MemoryAllocation *allocation);
+
+#endif // AURORA_MEMORY_H
@@ -0,0 +1,195 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "aurora_quadtree.h"
+
+static uint32_t create_cell(QuadTree *quadtree, int x, int y, int size) {
+    if (quadtree->cell_count == quadtree->cell_capacity) {
+        size_t new_capacity = quadtree->cell_capacity * 2;
+        QuadCell *cells = realloc(quadtree->cells, sizeof(QuadCell) * new_capacity);
+        if (cells == 0) { abort(); }
+        quadtree->cells = cells;
+        quadtree->cell_capacity = new_capacity;
+    }
+    uint32_t id = (uint32_t)quadtree->cell_count++;
+    QuadCell *cell = &quadtree->cells[id];
+    cell->x = x;
+    cell->y = y;
+    cell->size = size;
+    cell->link = QUAD_NONE;
+    return id;
+}
+
+static uint32_t create_bucket(QuadTree *quadtree) {
+    uint32_t id;
+    if (quadtree->free_bucket != QUAD_NONE) {
+        id = quadtree->free_bucket;
+        quadtree->free_bucket = quadtree->buckets[id].ids[0];
+    } else {
+        if (quadtree->bucket_used == quadtree->bucket_capacity) {
+            size_t new_capacity = quadtree->bucket_capacity * 2;
+            QuadBucket *buckets = realloc(quadtree->buckets, sizeof(QuadBucket) * new_capacity);
+            if (buckets == 0) { abort(); }
+            quadtree->buckets = buckets;
+            quadtree->bucket_capacity = new_capacity;
+        }
+        id = (uint32_t)quadtree->bucket_used++;
+    }
+    quadtree->buckets[id].count = 0;
+    return id;
+}
+
+static void release_bucket(QuadTree *quadtree, uint32_t id) {
+    quadtree->buckets[id].ids[0] = quadtree->free_bucket;
+    quadtree->free_bucket = id;
+}
+
+QuadTree *create_quadtree(int width, int height) {
+    QuadTree *quadtree = malloc(sizeof(QuadTree));
+    if (quadtree == 0) { abort(); }
+    quadtree->cell_capacity = 16;
+    quadtree->cell_count = 0;
+    quadtree->cells = malloc(sizeof(QuadCell) * quadtree->cell_capacity);
+    quadtree->bucket_capacity = 16;
+    quadtree->bucket_used = 0;
+    quadtree->free_bucket = QUAD_NONE;
+    quadtree->buckets = malloc(sizeof(QuadBucket) * quadtree->bucket_capacity);
+    quadtree->rect_capacity = 16;
+    quadtree->rects = malloc(sizeof(QuadRect) * quadtree->rect_capacity);
+    if (quadtree->cells == 0 || quadtree->buckets == 0 || quadtree->rects == 0) { abort(); }
+    // rectangles include their right and bottom edge, so the root has to cover one extra pixel
+    int size = 1;
+    while (size <= width || size <= height) {
+        size *= 2;
+    }
+    create_cell(quadtree, 0, 0, size);
+    return quadtree;
+}
+
+void destroy_quadtree(QuadTree *quadtree) {
+    free(quadtree->rects);
+    free(quadtree->buckets);
+    free(quadtree->cells);
+    free(quadtree);
+}
+
+static bool is_leaf(QuadCell *cell) {
+    return (cell->link & QUAD_LEAF_BIT) != 0;
+}
+
+static bool overlaps(QuadCell *cell, QuadRect *rect) {
+    return rect->x < cell->x + cell->size && rect->x + rect->width >= cell->x
+        && rect->y < cell->y + cell->size && rect->y + rect->height >= cell->y;
+}
+
+static void insert_recursive(QuadTree *quadtree, uint32_t cell_id, uint32_t id);
+
+static void subdivide(QuadTree *quadtree, uint32_t cell_id) {
+    QuadCell cell = quadtree->cells[cell_id];
+    int half = cell.size / 2;
+    uint32_t first = create_cell(quadtree, cell.x, cell.y, half);
+    create_cell(quadtree, cell.x + half, cell.y, half);
+    create_cell(quadtree, cell.x, cell.y + half, half);
+    create_cell(quadtree, cell.x + half, cell.y + half, half);
+    quadtree->cells[cell_id].link = first;
+    // the bucket is only full when subdividing, so it can be handed back before its items move down
+    uint32_t bucket = cell.link & ~QUAD_LEAF_BIT;
+    QuadBucket items = quadtree->buckets[bucket];
+    release_bucket(quadtree, bucket);
+    for (uint32_t i = 0; i < items.count; i++) {
+        insert_recursive(quadtree, cell_id, items.ids[i]);
+    }
+}
+
+static void insert_recursive(QuadTree *quadtree, uint32_t cell_id, uint32_t id) {
+    QuadCell *cell = &quadtree->cells[cell_id];
+    if (!overlaps(cell, &quadtree->rects[id])) return;
+    if (!is_leaf(cell)) {
+        uint32_t first = cell->link;
+        for (uint32_t i = 0; i < 4; i++) {
+            insert_recursive(quadtree, first + i, id);
+        }
+        return;
+    }
+    if (cell->link == QUAD_NONE) {
+        uint32_t bucket = create_bucket(quadtree);
+        quadtree->cells[cell_id].link = QUAD_LEAF_BIT | bucket;
+        cell = &quadtree->cells[cell_id];
+    }
+    QuadBucket *bucket = &quadtree->buckets[cell->link & ~QUAD_LEAF_BIT];
+    if (bucket->count < QUAD_CELL_CAPACITY) {
+        bucket->ids[bucket->count++] = id;
+        return;
+    }
+    if (cell->size == 1) {
+        printf("Too many overlapping rectangles in a single quadtree cell.\n");
+        abort();
+    }
+    subdivide(quadtree, cell_id);
+    insert_recursive(quadtree, cell_id, id);
+}
+
+void quadtree_insert(QuadTree *quadtree, int x, int y, int width, int height, uint32_t id) {
+    if (id >= quadtree->rect_capacity) {
+        size_t new_capacity = quadtree->rect_capacity;
+        while (new_capacity <= id) {
+            new_capacity *= 2;
+        }
+        QuadRect *rects = realloc(quadtree->rects, sizeof(QuadRect) * new_capacity);
+        if (rects == 0) { abort(); }
+        quadtree->rects = rects;
+        quadtree->rect_capacity = new_capacity;
+    }
+    quadtree->rects[id] = (QuadRect){ .x = x, .y = y, .width = width, .height = height };
+    insert_recursive(quadtree, 0, id);
+}
+
+static void remove_recursive(QuadTree *quadtree, uint32_t cell_id, QuadRect *rect, uint32_t id) {
+    QuadCell *cell = &quadtree->cells[cell_id];
+    if (!overlaps(cell, rect)) return;
+    if (!is_leaf(cell)) {
+        for (uint32_t i = 0; i < 4; i++) {
+            remove_recursive(quadtree, cell->link + i, rect, id);
+        }
+        return;
+    }
+    if (cell->link == QUAD_NONE) return;
+    uint32_t bucket_id = cell->link & ~QUAD_LEAF_BIT;
+    QuadBucket *bucket = &quadtree->buckets[bucket_id];
+    for (uint32_t i = 0; i < bucket->count; i++) {
+        if (bucket->ids[i] == id) {
+            bucket->ids[i] = bucket->ids[--bucket->count];
+            if (bucket->count == 0) {
+                release_bucket(quadtree, bucket_id);
+                cell->link = QUAD_NONE;
+            }
+            return;
+        }
+    }
+}
+
+void quadtree_remove(QuadTree *quadtree, int x, int y, int width, int height, uint32_t id) {
+    QuadRect rect = { .x = x, .y = y, .width = width, .height = height };
+    remove_recursive(quadtree, 0, &rect, id);
+}
+
+uint32_t quadtree_find(QuadTree *quadtree, int x, int y) {
+    QuadCell *cell = &quadtree->cells[0];
+    if (x < cell->x || y < cell->y || x >= cell->x + cell->size || y >= cell->y + cell->size) return QUAD_NONE;
+    while (!is_leaf(cell)) {
+        int half = cell->size / 2;
+        uint32_t child = cell->link;
+        if (x >= cell->x + half) child += 1;
+        if (y >= cell->y + half) child += 2;
+        cell = &quadtree->cells[child];
+    }
+    if (cell->link == QUAD_NONE) return QUAD_NONE;
+    QuadBucket *bucket = &quadtree->buckets[cell->link & ~QUAD_LEAF_BIT];
+    for (uint32_t i = 0; i < bucket->count; i++) {
+        QuadRect *rect = &quadtree->rects[bucket->ids[i]];
+        if (rect->x <= x && rect->y <= y && rect->x + rect->width >= x && rect->y + rect->height >= y) {
+            return bucket->ids[i];
+        }
+    }
+    return QUAD_NONE;
+}
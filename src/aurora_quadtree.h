@@ -0,0 +1,56 @@
+#ifndef AURORA_QUADTREE_H
+#define AURORA_QUADTREE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define QUAD_NONE UINT32_MAX
+#define QUAD_CELL_CAPACITY 8
+#define QUAD_LEAF_BIT 0x80000000u
+
+typedef struct {
+    int x, y;
+    int width, height;
+} QuadRect;
+
+/**
+ * A cell either has four children stored consecutively from link on (top left, top right, bottom left,
+ * bottom right), or it is a leaf and link is QUAD_LEAF_BIT | the bucket holding its items (QUAD_NONE while empty).
+ * An item is stored in every leaf cell its rectangle overlaps, so a point query only has to
+ * descend to the single leaf cell containing the point.
+ */
+typedef struct {
+    int x, y;
+    int size;
+    uint32_t link;
+} QuadCell;
+
+/**
+ * The item ids of one leaf cell, their rectangles are kept once per id in QuadTree.rects.
+ * A released bucket chains the free list through ids[0].
+ */
+typedef struct {
+    uint32_t count;
+    uint32_t ids[QUAD_CELL_CAPACITY];
+} QuadBucket;
+
+typedef struct {
+    QuadCell *cells;
+    size_t cell_count;
+    size_t cell_capacity;
+    QuadBucket *buckets;
+    size_t bucket_used;
+    size_t bucket_capacity;
+    uint32_t free_bucket;
+    QuadRect *rects;
+    size_t rect_capacity;
+} QuadTree;
+
+extern QuadTree *create_quadtree(int width, int height);
+extern void destroy_quadtree(QuadTree *quadtree);
+extern void quadtree_insert(QuadTree *quadtree, int x, int y, int width, int height, uint32_t id);
+extern void quadtree_remove(QuadTree *quadtree, int x, int y, int width, int height, uint32_t id);
+extern uint32_t quadtree_find(QuadTree *quadtree, int x, int y);
+
+#endif // AURORA_QUADTREE_H
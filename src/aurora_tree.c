@@ -1,174 +1,424 @@
 #include <stdlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
 #include "aurora_tree.h"
 
 const int capacity = 10;
 
-static Node* create_node(int x, int y, int width, int height, Node* parent, Node** children, size_t child_count) {
-    Node* node = malloc(sizeof(Node));
-    if (node == 0) { abort(); };
+static uint32_t create_node(Tree *tree, int x, int y, int width, int height, uint32_t parent) {
+    if (tree->node_used == tree->node_capacity) {
+        size_t new_capacity = tree->node_capacity * 2;
+        Node *nodes = realloc(tree->nodes, sizeof(Node) * new_capacity);
+        if (nodes == 0) { abort(); }
+        tree->nodes = nodes;
+        tree->node_capacity = new_capacity;
+    }
+    uint32_t id = (uint32_t)tree->node_used++;
+    Node *node = &tree->nodes[id];
     node->x = x;
     node->y = y;
     node->width = width;
     node->height = height;
     node->parent = parent;
-    node->children = children;
-    node->child_count = child_count;
-    node->child_capacity = child_count != 0 ? 2 * child_count : capacity;
-    return node;
+    node->first_child = NODE_NONE;
+    node->next_sibling = NODE_NONE;
+    node->child_count = 0;
+    node->leaf_count = 1;
+    node->slot = NODE_NONE;
+    node->dirty = false;
+    return id;
+}
+
+static void mark_dirty(Tree *tree, uint32_t id) {
+    if (tree->nodes[id].dirty) return;
+    if (tree->dirty_count == tree->dirty_capacity) {
+        size_t new_capacity = tree->dirty_capacity * 2;
+        uint32_t *dirty = realloc(tree->dirty, sizeof(uint32_t) * new_capacity);
+        if (dirty == 0) { abort(); }
+        tree->dirty = dirty;
+        LeafPatch *patches = realloc(tree->patches, sizeof(LeafPatch) * new_capacity);
+        if (patches == 0) { abort(); }
+        tree->patches = patches;
+        tree->dirty_capacity = new_capacity;
+    }
+    tree->nodes[id].dirty = true;
+    tree->dirty[tree->dirty_count++] = id;
+}
+
+static void assign_slot(Tree *tree, uint32_t id) {
+    if (tree->slot_count == tree->slot_capacity) {
+        size_t new_capacity = tree->slot_capacity * 2;
+        uint32_t *slots = realloc(tree->slots, sizeof(uint32_t) * new_capacity);
+        if (slots == 0) { abort(); }
+        tree->slots = slots;
+        tree->slot_capacity = new_capacity;
+    }
+    tree->nodes[id].slot = (uint32_t)tree->slot_count;
+    tree->slots[tree->slot_count++] = id;
+    mark_dirty(tree, id);
 }
 
 Tree *create_tree(int width, int height){
-    Node* node = create_node(0, 0, width, height, NULL, malloc(sizeof(Node *) * capacity), 0);
     Tree *tree = malloc(sizeof(Tree));
     if (tree == 0) { abort(); }
+    tree->nodes = malloc(sizeof(Node) * capacity);
+    if (tree->nodes == 0) { abort(); }
+    tree->node_capacity = capacity;
+    tree->node_used = 0;
+    tree->slots = malloc(sizeof(uint32_t) * capacity);
+    if (tree->slots == 0) { abort(); }
+    tree->slot_capacity = capacity;
+    tree->slot_count = 0;
+    tree->dirty = malloc(sizeof(uint32_t) * capacity);
+    tree->patches = malloc(sizeof(LeafPatch) * capacity);
+    if (tree->dirty == 0 || tree->patches == 0) { abort(); }
+    tree->dirty_capacity = capacity;
+    tree->dirty_count = 0;
+    tree->root = create_node(tree, 0, 0, width, height, NODE_NONE);
+    assign_slot(tree, tree->root);
     tree->width = width;
     tree->height = height;
     tree->node_count = 1;
-    tree->root = node;
     tree->rotation = VERTICAL;
+    tree->index = NULL;
+    tree->leaf_kernel = get_best_leaf_kernel();
     return tree;
 }
 
+void destroy_tree(Tree *tree){
+    if (tree->index != NULL) {
+        destroy_quadtree(tree->index);
+    }
+    free(tree->patches);
+    free(tree->dirty);
+    free(tree->slots);
+    free(tree->nodes);
+    free(tree);
+}
+
 bool contains(Node *node, int x, int y){
     return node->x <= x && node->y <= y && node->x + node->width >= x && node->y + node->height >= y;
 }
 
-void insert_child(Node *parent, Node *child){
-    for(size_t i = 0; i < parent->child_capacity; i++){
-        if(parent->children[i] == NULL){
-            parent->children[i] = child;
-            return;
-        }
-    }
-    // no slot found
-    Node** nodes = malloc(sizeof(Node*) * parent->child_capacity * 2);
-    if (nodes == 0) { abort(); }
-    Node** old_nodes = parent->children;
-    parent->children = nodes;
-    for (size_t i = 0; i < parent->child_count; i++) {
-        parent->children[i] = old_nodes[i];
-    }
-    parent->children[parent->child_count] = child;
-    parent->child_count += 1;
-    free(old_nodes);
-}
-
-size_t remove_child(Node* parent, Node* child){
-    for(size_t i = 0; i < parent->child_capacity; i++){
-        if(parent->children[i] == child){
-            free(child);
-            parent->children[i] = NULL;
-            return i;
-        }
-    }
-    return 0; // t odo ffix
+void insert_child(Tree *tree, uint32_t parent, uint32_t child){
+    tree->nodes[child].parent = parent;
+    tree->nodes[child].next_sibling = tree->nodes[parent].first_child;
+    tree->nodes[parent].first_child = child;
+    tree->nodes[parent].child_count += 1;
 }
 
-Node* find_at_recursive(Node *node, int x, int y){
+void insert_sibling(Tree *tree, uint32_t previous, uint32_t child){
+    uint32_t parent = tree->nodes[previous].parent;
+    tree->nodes[child].parent = parent;
+    tree->nodes[child].next_sibling = tree->nodes[previous].next_sibling;
+    tree->nodes[previous].next_sibling = child;
+    tree->nodes[parent].child_count += 1;
+}
+
+Node* find_at_recursive(Tree *tree, uint32_t id, int x, int y){
+    Node *node = &tree->nodes[id];
     if (!contains(node, x, y)) return NULL;
     if (node->child_count == 0) return node;
-    for (size_t i = 0; i < node->child_count; i++) {
-        if (!contains(node->children[i], x, y)) continue;
-        return find_at_recursive(node->children[i], x, y);
+    for (uint32_t child = node->first_child; child != NODE_NONE; child = tree->nodes[child].next_sibling) {
+        if (!contains(&tree->nodes[child], x, y)) continue;
+        return find_at_recursive(tree, child, x, y);
     }
     return NULL;
 }
 
-void print_node(Node *node){
+void print_node(Tree *tree, uint32_t id){
+    Node *node = &tree->nodes[id];
     printf("Printing a Node: \n");
     printf("The position: (x, y) = (%d, %d)\n", node->x, node->y);
     printf("The dimensions: (width, height) = (%d, %d)\n", node->width, node->height);
-    printf("The child count: %d\n", node->child_count);
-    for(size_t i = 0; i < node->child_count; i++){
-        print_node(node->children[i]);
+    printf("The child count: %u\n", node->child_count);
+    for (uint32_t child = node->first_child; child != NODE_NONE; child = tree->nodes[child].next_sibling) {
+        print_node(tree, child);
     }
     printf("\n");
 }
 
+static void index_leaves(Tree *tree, uint32_t id){
+    Node *node = &tree->nodes[id];
+    if (node->child_count == 0) {
+        quadtree_insert(tree->index, node->x, node->y, node->width, node->height, id);
+        return;
+    }
+    for (uint32_t child = node->first_child; child != NODE_NONE; child = tree->nodes[child].next_sibling) {
+        index_leaves(tree, child);
+    }
+}
+
+/**
+ * Keeps a quadtree over the leaf rectangles next to the tree, so find_at no longer walks the children.
+ */
+void enable_spatial_index(Tree *tree){
+    if (tree->index != NULL) return;
+    tree->index = create_quadtree(tree->width, tree->height);
+    index_leaves(tree, tree->root);
+}
+
 Node* find_at(Tree* tree, int x, int y) {
-    return find_at_recursive(tree->root, x, y);
+    if (tree->index != NULL) {
+        uint32_t id = quadtree_find(tree->index, x, y);
+        return id == QUAD_NONE ? NULL : &tree->nodes[id];
+    }
+    return find_at_recursive(tree, tree->root, x, y);
 }
 
 void split_node(Tree *tree, Node *current, int x, int y){
-    Node* left = create_node(current->x, current->y, x - current->x, current->height, NULL, malloc(sizeof(Node *) * capacity), 0);
-    Node *right = create_node(x, current->y, current->width - x + current->x, current->height, NULL, malloc(sizeof(Node*) * capacity), 0);
-    print_node(current);
-    if(current->parent != NULL){
-        int removed_index = remove_child(current->parent, current);
-        current->parent->children[removed_index] = left;
-        left->parent = current->parent;
-        current->parent->children[(current->parent->child_count)++] = right;
-        right->parent = current->parent;
+    // splitting on an edge would leave an empty leaf behind
+    if (current == NULL || x <= current->x || x >= current->x + current->width) return;
+    // the pool may move while creating nodes, so only hold on to the index
+    uint32_t id = (uint32_t)(current - tree->nodes);
+    int current_x = current->x;
+    int current_y = current->y;
+    int current_width = current->width;
+    int current_height = current->height;
+    uint32_t right = create_node(tree, x, current_y, current_width - x + current_x, current_height, NODE_NONE);
+    uint32_t left = id;
+    if(tree->nodes[id].parent != NODE_NONE){
+        // the current leaf shrinks into the left half in place, so only the right half is new
+        tree->nodes[id].width = x - current_x;
+        insert_sibling(tree, id, right);
+        mark_dirty(tree, id);
+        tree->node_count += 1;
     }else{
-        insert_child(current, left);
-        insert_child(current, right);
-    }
-    tree->node_count += 1;
-}
-
-float translate_to_screenspace(int number, int width, int height, Rotation rotation){
-    switch(rotation){
-        case HORIZONTAL:
-            return 2.0f * ((float)number / (float)width) - 1.0f;
-        case VERTICAL:
-            return 2.0f * ((float)number / (float)height) - 1.0f;
-        default:
-            printf("Error");
-            abort();
-    }
-}
-
-void translate(Node *current, Vertex **vertices, size_t *vertex_index, uint16_t **indices, size_t *index_index, int w, int h){
-    if(current->child_count == 0){
-        vec3s red = { .x = 1.0f, .y = 0.0f, .z = 0.0f};
-        vec3s green = { .x = 0.0f, .y = 1.0f, .z = 0.0f};
-        vec3s blue = { .x= 0.0f, .y = 0.0f, .z = 1.0f};
-        vec3s yellow = { .x = 1.0f, .y = 1.0f, .z = 0.0f};
-        Vertex top_left = {
-            .position.x = translate_to_screenspace(current->x, w, h, HORIZONTAL),
-            .position.y = translate_to_screenspace(current->y, w, h, VERTICAL),
-            .color = red
-        };
-        Vertex top_right = {
-              .position.x = translate_to_screenspace(current->x + current->width, w, h, HORIZONTAL),
-              .position.y = translate_to_screenspace(current->y, w, h, VERTICAL),
-              .color = green
-        };
-        Vertex bottom_left = {
-              .position.x = translate_to_screenspace(current->x, w, h, HORIZONTAL),
-              .position.y = translate_to_screenspace(current->y + current->height, w, h, VERTICAL),
-              .color = blue
-        };
-        Vertex bottom_right = {
-              .position.x = translate_to_screenspace(current->x + current->width, w, h, HORIZONTAL),
-              .position.y = translate_to_screenspace(current->y + current->height, w, h, VERTICAL),
-              .color = yellow
+        left = create_node(tree, current_x, current_y, x - current_x, current_height, NODE_NONE);
+        insert_child(tree, id, right);
+        insert_child(tree, id, left);
+        // the root stops being a leaf, its slot is handed to the left half
+        uint32_t slot = tree->nodes[id].slot;
+        tree->nodes[id].slot = NODE_NONE;
+        tree->nodes[left].slot = slot;
+        tree->slots[slot] = left;
+        mark_dirty(tree, left);
+        tree->node_count += 2;
+    }
+    assign_slot(tree, right);
+    // the split leaf lives on as the left half, so every ancestor gained exactly the right half
+    for(uint32_t ancestor = tree->nodes[right].parent; ancestor != NODE_NONE; ancestor = tree->nodes[ancestor].parent){
+        tree->nodes[ancestor].leaf_count += 1;
+    }
+    if(tree->index != NULL){
+        quadtree_remove(tree->index, current_x, current_y, current_width, current_height, id);
+        quadtree_insert(tree->index, current_x, current_y, x - current_x, current_height, left);
+        quadtree_insert(tree->index, x, current_y, current_width - x + current_x, current_height, right);
+    }
+}
+
+/**
+ * The two triangles of the leaf in the given slot, always the same for a slot.
+ */
+void get_leaf_indices(uint32_t slot, uint32_t *indices){
+    uint32_t vertex_start_index = slot * VERTICES_PER_LEAF;
+    indices[0] = vertex_start_index;
+    indices[1] = vertex_start_index + 1;
+    indices[2] = vertex_start_index + 2;
+    indices[3] = vertex_start_index + 2;
+    indices[4] = vertex_start_index + 3;
+    indices[5] = vertex_start_index + 1;
+}
+
+/**
+ * Positions stay in layout pixels, the view transform pushed at draw time maps them to the screen.
+ */
+static void translate_leaf(Tree *tree, Node *current, Vertex *vertices, uint32_t *indices){
+    LeafRect rect = { current->x, current->y, current->width, current->height };
+    tree->leaf_kernel(&rect, 1, vertices);
+    get_leaf_indices(current->slot, indices);
+}
+
+static void translate_instance(Node *current, RectInstance *instance){
+    instance->position.x = (float)current->x;
+    instance->position.y = (float)current->y;
+    instance->size.x = (float)current->width;
+    instance->size.y = (float)current->height;
+    instance->color = (vec3s){ .x = 1.0f, .y = 1.0f, .z = 1.0f };
+}
+
+/**
+ * One contiguous range of slots. Every leaf writes to the offset of its own slot,
+ * so jobs over disjoint ranges never touch the same part of the output.
+ */
+typedef struct {
+    Tree *tree;
+    size_t begin;
+    size_t end;
+    Vertex *vertices;
+    uint32_t *indices;
+    RectInstance *instances;
+} TranslateJob;
+
+static void run_translate_job(TranslateJob *job){
+    Tree *tree = job->tree;
+    if(job->instances != NULL){
+        for(size_t slot = job->begin; slot < job->end; slot++){
+            translate_instance(&tree->nodes[tree->slots[slot]], &job->instances[slot]);
+        }
+        return;
+    }
+    // the slots of a job are consecutive, so each batch lands in one contiguous run of vertices
+    LeafRect rects[LEAF_BATCH];
+    for(size_t batch = job->begin; batch < job->end; batch += LEAF_BATCH){
+        size_t count = job->end - batch < LEAF_BATCH ? job->end - batch : LEAF_BATCH;
+        for(size_t i = 0; i < count; i++){
+            Node *current = &tree->nodes[tree->slots[batch + i]];
+            rects[i] = (LeafRect){ current->x, current->y, current->width, current->height };
+            get_leaf_indices((uint32_t)(batch + i), &job->indices[(batch + i) * INDICES_PER_LEAF]);
+        }
+        tree->leaf_kernel(rects, count, &job->vertices[batch * VERTICES_PER_LEAF]);
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI translate_thread(LPVOID data){
+    run_translate_job(data);
+    return 0;
+}
+#else
+static void *translate_thread(void *data){
+    run_translate_job(data);
+    return NULL;
+}
+#endif
+
+static size_t get_thread_count(size_t leaf_count){
+    size_t wanted = leaf_count / LEAVES_PER_THREAD;
+    if(wanted <= 1) return 1;
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    size_t cores = info.dwNumberOfProcessors;
+#else
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t cores = online > 0 ? (size_t)online : 1;
+#endif
+    if(wanted > cores) wanted = cores;
+    return wanted > MAX_DRAW_THREADS ? MAX_DRAW_THREADS : wanted;
+}
+
+/**
+ * Translates every leaf, splitting the slots over worker threads for large layouts.
+ * The calling thread takes the first range itself. A thread that fails to start leaves its range to the caller.
+ */
+static void translate_all(Tree *tree, Vertex *vertices, uint32_t *indices, RectInstance *instances){
+    size_t leaf_count = get_leaf_count(tree);
+    size_t thread_count = get_thread_count(leaf_count);
+    TranslateJob jobs[MAX_DRAW_THREADS];
+    bool started[MAX_DRAW_THREADS] = { false };
+#ifdef _WIN32
+    HANDLE threads[MAX_DRAW_THREADS];
+#else
+    pthread_t threads[MAX_DRAW_THREADS];
+#endif
+    for(size_t i = 0; i < thread_count; i++){
+        jobs[i] = (TranslateJob){
+            .tree = tree,
+            .begin = leaf_count * i / thread_count,
+            .end = leaf_count * (i + 1) / thread_count,
+            .vertices = vertices,
+            .indices = indices,
+            .instances = instances
         };
-        size_t vertex_start_index = *vertex_index;
-        (*vertices)[(*vertex_index)++] = top_left;
-        (*vertices)[(*vertex_index)++] = top_right;
-        (*vertices)[(*vertex_index)++] = bottom_left;
-        (*vertices)[(*vertex_index)++] = bottom_right;
-        (*indices)[(*index_index)++] = vertex_start_index;
-        (*indices)[(*index_index)++] = vertex_start_index + 1;
-        (*indices)[(*index_index)++] = vertex_start_index + 2;
-        (*indices)[(*index_index)++] = vertex_start_index + 2;
-        (*indices)[(*index_index)++] = vertex_start_index + 3;
-        (*indices)[(*index_index)++] = vertex_start_index + 1;
-    }else{
-        for(size_t i = 0; i < current->child_count; i++){
-            translate(current->children[i], vertices, vertex_index, indices, index_index, w, h);
+    }
+    for(size_t i = 1; i < thread_count; i++){
+#ifdef _WIN32
+        threads[i] = CreateThread(NULL, 0, translate_thread, &jobs[i], 0, NULL);
+        started[i] = threads[i] != NULL;
+#else
+        started[i] = pthread_create(&threads[i], NULL, translate_thread, &jobs[i]) == 0;
+#endif
+    }
+    run_translate_job(&jobs[0]);
+    for(size_t i = 1; i < thread_count; i++){
+        if(!started[i]){
+            run_translate_job(&jobs[i]);
+            continue;
         }
+#ifdef _WIN32
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
     }
 }
 
-void get_draw_data(Tree *tree, Vertex **vertices, size_t *vertex_count, uint16_t **indices, size_t *index_count){
-    *vertex_count = tree->node_count * 4;
-    *index_count = tree->node_count * 6;
+static void clear_dirty(Tree *tree){
+    for(size_t i = 0; i < tree->dirty_count; i++){
+        tree->nodes[tree->dirty[i]].dirty = false;
+    }
+    tree->dirty_count = 0;
+}
+
+void get_draw_data(Tree *tree, Vertex **vertices, size_t *vertex_count, uint32_t **indices, size_t *index_count){
+    size_t leaf_count = get_leaf_count(tree);
+    *vertex_count = leaf_count * VERTICES_PER_LEAF;
+    *index_count = leaf_count * INDICES_PER_LEAF;
     *vertices = malloc(sizeof(Vertex) * (*vertex_count));
-    *indices = malloc(sizeof(uint16_t) * (*index_count));
-    size_t vertex_index = 0;
-    size_t index_index = 0;
-    translate(tree->root, vertices, &vertex_index, indices, &index_index, tree->width, tree->height);
-}
\ No newline at end of file
+    *indices = malloc(sizeof(uint32_t) * (*index_count));
+    if (*vertices == 0 || *indices == 0) { abort(); }
+    translate_all(tree, *vertices, *indices, NULL);
+    clear_dirty(tree);
+}
+
+uint32_t get_leaf_slot(Tree *tree, Node *leaf){
+    (void)tree;
+    return leaf->slot;
+}
+
+/**
+ * The number of leaves, and so of rectangles drawn. Every leaf holds one slot, so the slots below this count are all in use.
+ */
+size_t get_leaf_count(Tree *tree){
+    return tree->nodes[tree->root].leaf_count;
+}
+
+void get_instance_data(Tree *tree, RectInstance **instances, size_t *instance_count){
+    *instance_count = get_leaf_count(tree);
+    *instances = malloc(sizeof(RectInstance) * (*instance_count));
+    if (*instances == 0) { abort(); }
+    translate_all(tree, NULL, NULL, *instances);
+    clear_dirty(tree);
+}
+
+/**
+ * Same as get_draw_patches, but only fills in the instance of every patch.
+ */
+LeafPatch *get_instance_patches(Tree *tree, size_t *patch_count){
+    size_t count = 0;
+    for(size_t i = 0; i < tree->dirty_count; i++){
+        Node *node = &tree->nodes[tree->dirty[i]];
+        if(node->slot == NODE_NONE) continue;
+        LeafPatch *patch = &tree->patches[count++];
+        patch->slot = node->slot;
+        translate_instance(node, &patch->instance);
+    }
+    clear_dirty(tree);
+    *patch_count = count;
+    return tree->patches;
+}
+
+/**
+ * Translates only the leaves touched since the last call (or the last get_draw_data).
+ * The returned array is owned by the tree and stays valid until the next split.
+ */
+LeafPatch *get_draw_patches(Tree *tree, size_t *patch_count){
+    size_t count = 0;
+    for(size_t i = 0; i < tree->dirty_count; i++){
+        Node *node = &tree->nodes[tree->dirty[i]];
+        if(node->slot == NODE_NONE) continue;
+        LeafPatch *patch = &tree->patches[count++];
+        patch->slot = node->slot;
+        translate_leaf(tree, node, patch->vertices, patch->indices);
+    }
+    clear_dirty(tree);
+    *patch_count = count;
+    return tree->patches;
+}
@@ -1,8 +1,20 @@
 #ifndef AURORA_TREE_H
 #define AURORA_TREE_H
 #include "aurora.h"
+#include "aurora_quadtree.h"
+#include "aurora_vertex.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+
+#define NODE_NONE UINT32_MAX
+#define VERTICES_PER_LEAF 4
+#define INDICES_PER_LEAF 6
+// full rebuilds of smaller layouts are not worth starting threads for
+#define LEAVES_PER_THREAD 16384
+#define MAX_DRAW_THREADS 16
+// leaves gathered into rects before each call of the vertex kernel
+#define LEAF_BATCH 256
 
 typedef struct Node Node;
 
@@ -11,21 +23,54 @@ typedef enum Rotation {
     VERTICAL
 } Rotation;
 
+/**
+ * Nodes live in one contiguous pool owned by the Tree and refer to each other by index.
+ * Children form a singly linked sibling list. Nodes are never removed, a split only adds them.
+ * A Node pointer returned by find_at stays valid only until the next split, since the pool may grow.
+ * leaf_count is the number of leaves in the subtree of the node, 1 for a leaf itself.
+ */
 struct Node {
     int x, y;
     int width, height;
-    Node *parent;
-    Node **children;
-    size_t child_count;
-    size_t child_capacity;
+    uint32_t parent;
+    uint32_t first_child;
+    uint32_t next_sibling;
+    uint32_t child_count;
+    uint32_t leaf_count;
+    uint32_t slot;
+    bool dirty;
 };
 
+/**
+ * Every leaf owns a slot, which stays the same for as long as the leaf exists.
+ * A leaf in slot s is drawn from vertices [s * VERTICES_PER_LEAF, (s + 1) * VERTICES_PER_LEAF)
+ * and indices [s * INDICES_PER_LEAF, (s + 1) * INDICES_PER_LEAF).
+ */
+typedef struct {
+    uint32_t slot;
+    Vertex vertices[VERTICES_PER_LEAF];
+    uint32_t indices[INDICES_PER_LEAF];
+    RectInstance instance;
+} LeafPatch;
+
 typedef struct{
-    Node *root;
+    Node *nodes;
+    size_t node_capacity;
+    size_t node_used;
+    uint32_t root;
     size_t node_count;
     int width;
     int height;
     Rotation rotation;
+    QuadTree *index;
+    LeafKernel leaf_kernel;
+    uint32_t *slots;
+    size_t slot_count;
+    size_t slot_capacity;
+    uint32_t *dirty;
+    LeafPatch *patches;
+    size_t dirty_count;
+    size_t dirty_capacity;
 } Tree;
 /**
  * To add rotation of tree elements, we need to add glfw key callback (to select which area to traverse down to / rotate)
@@ -33,8 +78,16 @@ typedef struct{
  */
 
 extern Tree *create_tree(int width, int height);
+extern void destroy_tree(Tree *tree);
+extern void enable_spatial_index(Tree *tree);
 extern void split_node(Tree *tree, Node *current, int x, int y);
-extern void get_draw_data(Tree *tree, Vertex **vertices, size_t *vertex_count, uint16_t **indices, size_t *index_count);
+extern void get_draw_data(Tree *tree, Vertex **vertices, size_t *vertex_count, uint32_t **indices, size_t *index_count);
+extern void get_leaf_indices(uint32_t slot, uint32_t *indices);
 extern Node* find_at(Tree *tree, int x, int y);
+extern uint32_t get_leaf_slot(Tree *tree, Node *leaf);
+extern size_t get_leaf_count(Tree *tree);
+extern LeafPatch *get_draw_patches(Tree *tree, size_t *patch_count);
+extern void get_instance_data(Tree *tree, RectInstance **instances, size_t *instance_count);
+extern LeafPatch *get_instance_patches(Tree *tree, size_t *patch_count);
 
 #endif // AURORA_TREE_H
\ No newline at end of file
@@ -0,0 +1,134 @@
+#include "aurora_vertex.h"
+
+// sse2 is part of every x86-64 cpu, avx2 is checked for at runtime
+#if defined(__x86_64__) || defined(_M_X64)
+#define LEAF_KERNEL_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// the kernels write a vertex as five consecutive floats
+_Static_assert(sizeof(Vertex) == 5 * sizeof(float), "Vertex is expected to be tightly packed");
+
+static void write_leaf_vertices_scalar(const LeafRect *rects, size_t count, Vertex *vertices) {
+    for (size_t i = 0; i < count; i++) {
+        float left = (float)rects[i].x;
+        float top = (float)rects[i].y;
+        float right = (float)(rects[i].x + rects[i].width);
+        float bottom = (float)(rects[i].y + rects[i].height);
+        Vertex *corners = &vertices[i * 4];
+        corners[0] = (Vertex){ .position = { .x = left, .y = top }, .color = { .x = 1.0f, .y = 0.0f, .z = 0.0f } };
+        corners[1] = (Vertex){ .position = { .x = right, .y = top }, .color = { .x = 0.0f, .y = 1.0f, .z = 0.0f } };
+        corners[2] = (Vertex){ .position = { .x = left, .y = bottom }, .color = { .x = 0.0f, .y = 0.0f, .z = 1.0f } };
+        corners[3] = (Vertex){ .position = { .x = right, .y = bottom }, .color = { .x = 1.0f, .y = 1.0f, .z = 0.0f } };
+    }
+}
+
+#ifdef LEAF_KERNEL_X86
+/*
+ * Both vector kernels turn one rect (x, y, w, h) into (left, top, right, bottom) with a single add and
+ * conversion, then assemble the 20 floats of its four corners as five vectors of four:
+ *   (left, top, 1, 0) (0, right, top, 0) (1, 0, left, bottom) (0, 0, 1, right) (bottom, 1, 1, 0)
+ * Each vector is a shuffle of the corners, masked to its position lanes and or'ed with the color constants.
+ */
+static void write_leaf_vertices_sse2(const LeafRect *rects, size_t count, Vertex *vertices) {
+    const __m128 mask0 = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, 0, 0));
+    const __m128 mask1 = _mm_castsi128_ps(_mm_setr_epi32(0, -1, -1, 0));
+    const __m128 mask2 = _mm_castsi128_ps(_mm_setr_epi32(0, 0, -1, -1));
+    const __m128 mask3 = _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, -1));
+    const __m128 mask4 = _mm_castsi128_ps(_mm_setr_epi32(-1, 0, 0, 0));
+    const __m128 color0 = _mm_setr_ps(0.0f, 0.0f, 1.0f, 0.0f);
+    const __m128 color2 = _mm_setr_ps(1.0f, 0.0f, 0.0f, 0.0f);
+    const __m128 color4 = _mm_setr_ps(0.0f, 1.0f, 1.0f, 0.0f);
+    float *out = (float*)vertices;
+    for (size_t i = 0; i < count; i++, out += 20) {
+        __m128i rect = _mm_loadu_si128((const __m128i*)&rects[i]);
+        __m128 edges = _mm_cvtepi32_ps(_mm_add_epi32(rect, _mm_slli_si128(rect, 8)));
+        _mm_storeu_ps(out, _mm_or_ps(_mm_and_ps(edges, mask0), color0));
+        _mm_storeu_ps(out + 4, _mm_and_ps(_mm_shuffle_ps(edges, edges, _MM_SHUFFLE(0, 1, 2, 0)), mask1));
+        _mm_storeu_ps(out + 8, _mm_or_ps(_mm_and_ps(_mm_shuffle_ps(edges, edges, _MM_SHUFFLE(3, 0, 0, 0)), mask2), color2));
+        _mm_storeu_ps(out + 12, _mm_or_ps(_mm_and_ps(_mm_shuffle_ps(edges, edges, _MM_SHUFFLE(2, 0, 0, 0)), mask3), color0));
+        _mm_storeu_ps(out + 16, _mm_or_ps(_mm_and_ps(_mm_shuffle_ps(edges, edges, _MM_SHUFFLE(0, 0, 0, 3)), mask4), color4));
+    }
+}
+
+/**
+ * Two rects per step: the eight edges of the pair are permuted across the whole register straight into
+ * the 40 floats of their corners and blended with the colors, so the pair goes out as five full stores.
+ */
+TARGET_AVX2 static void write_leaf_vertices_avx2(const LeafRect *rects, size_t count, Vertex *vertices) {
+    // edges of the pair: 0 left, 1 top, 2 right, 3 bottom of the first rect, 4 to 7 the same of the second
+    const __m256i order0 = _mm256_setr_epi32(0, 1, 0, 0, 0, 2, 1, 0);
+    const __m256i order1 = _mm256_setr_epi32(0, 0, 0, 3, 0, 0, 0, 2);
+    const __m256i order2 = _mm256_setr_epi32(3, 0, 0, 0, 4, 5, 0, 0);
+    const __m256i order3 = _mm256_setr_epi32(0, 6, 5, 0, 0, 0, 4, 7);
+    const __m256i order4 = _mm256_setr_epi32(0, 0, 0, 6, 7, 0, 0, 0);
+    const __m256 color0 = _mm256_setr_ps(0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f);
+    const __m256 color1 = _mm256_setr_ps(1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f);
+    const __m256 color2 = _mm256_setr_ps(0.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f);
+    const __m256 color3 = _mm256_setr_ps(0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f);
+    const __m256 color4 = _mm256_setr_ps(0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 1.0f, 0.0f);
+    float *out = (float*)vertices;
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2, out += 40) {
+        __m256i pair = _mm256_loadu_si256((const __m256i*)&rects[i]);
+        __m256 edges = _mm256_cvtepi32_ps(_mm256_add_epi32(pair, _mm256_slli_si256(pair, 8)));
+        // the blend masks pick the position lanes, bit n stands for lane n
+        _mm256_storeu_ps(out, _mm256_blend_ps(color0, _mm256_permutevar8x32_ps(edges, order0), 0x63));
+        _mm256_storeu_ps(out + 8, _mm256_blend_ps(color1, _mm256_permutevar8x32_ps(edges, order1), 0x8C));
+        _mm256_storeu_ps(out + 16, _mm256_blend_ps(color2, _mm256_permutevar8x32_ps(edges, order2), 0x31));
+        _mm256_storeu_ps(out + 24, _mm256_blend_ps(color3, _mm256_permutevar8x32_ps(edges, order3), 0xC6));
+        _mm256_storeu_ps(out + 32, _mm256_blend_ps(color4, _mm256_permutevar8x32_ps(edges, order4), 0x18));
+    }
+    write_leaf_vertices_sse2(&rects[i], count - i, &vertices[i * 4]);
+}
+
+static bool cpu_supports_avx2(void) {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    // the os has to save the ymm registers as well
+    if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+/**
+ * Returns NULL when this cpu cannot run the given level.
+ */
+LeafKernel get_leaf_kernel(LeafKernelLevel level) {
+    switch (level) {
+        case LEAF_KERNEL_SCALAR:
+            return write_leaf_vertices_scalar;
+#ifdef LEAF_KERNEL_X86
+        case LEAF_KERNEL_SSE2:
+            return write_leaf_vertices_sse2;
+        case LEAF_KERNEL_AVX2:
+            return cpu_supports_avx2() ? write_leaf_vertices_avx2 : NULL;
+#endif
+        default:
+            return NULL;
+    }
+}
+
+/**
+ * Picks the widest kernel the cpu runs. Patches translate one rect at a time, which avx2 hands to its sse2 tail.
+ */
+LeafKernel get_best_leaf_kernel(void) {
+    LeafKernel kernel = get_leaf_kernel(LEAF_KERNEL_AVX2);
+    if (kernel == NULL) kernel = get_leaf_kernel(LEAF_KERNEL_SSE2);
+    if (kernel == NULL) kernel = get_leaf_kernel(LEAF_KERNEL_SCALAR);
+    return kernel;
+}
@@ -0,0 +1,25 @@
+#ifndef AURORA_VERTEX_H
+#define AURORA_VERTEX_H
+
+#include "aurora.h"
+
+typedef struct {
+    int x, y;
+    int width, height;
+} LeafRect;
+
+typedef enum {
+    LEAF_KERNEL_SCALAR,
+    LEAF_KERNEL_SSE2,
+    LEAF_KERNEL_AVX2
+} LeafKernelLevel;
+
+/**
+ * Writes the VERTICES_PER_LEAF corner vertices of every rect, in layout pixels, to vertices[i * 4 ...].
+ */
+typedef void (*LeafKernel)(const LeafRect *rects, size_t count, Vertex *vertices);
+
+extern LeafKernel get_leaf_kernel(LeafKernelLevel level);
+extern LeafKernel get_best_leaf_kernel(void);
+
+#endif // AURORA_VERTEX_H
@@ -6,22 +6,27 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
 
 #include "aurora_internal.h"
 #include "io.h"
+#include "shader/vert_spv.h"
+#include "shader/frag_spv.h"
+#include "shader/instanced_vert_spv.h"
 
 const int validation_layer_count = 1;
 const char *validation_layers[] = {"VK_LAYER_KHRONOS_validation"};
 const int extension_count = 1;
 const char* extensions[] = {"VK_KHR_swapchain"};
-const int MAX_FRAMES_IN_FLIGHT = 2;
+const int MAX_FRAMES_IN_FLIGHT = 4;
+const size_t FRAME_STATS_CAPACITY = 128;
 uint32_t current_frame = 0;
 
-void create_window(VkSession* session) {
+void create_window(VkConfig *config, VkSession* session) {
 	assert(session != NULL);
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API); // dont use openGL
-    glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-    session->window = glfwCreateWindow(800, 600, "Vulkan", NULL, NULL);
+    glfwWindowHint(GLFW_RESIZABLE, config->allow_resize ? GLFW_TRUE : GLFW_FALSE);
+    session->window = glfwCreateWindow(config->width, config->height, "Vulkan", NULL, NULL);
 	assert(session->window != NULL);
 }
 
@@ -63,6 +68,16 @@ void create_vk_instance(VkConfig *config, VkSession *session){
 	app_info.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
 	app_info.pEngineName = "Not an engine";
 	app_info.apiVersion = VK_MAKE_VERSION(1, 0, 0);
+	// dynamic rendering is core in 1.3, the device still has to support it as well
+	session->dynamic_rendering = false;
+	if(config->dynamic_rendering){
+		uint32_t instance_version = VK_API_VERSION_1_0;
+		vkEnumerateInstanceVersion(&instance_version);
+		if(instance_version >= VK_API_VERSION_1_3){
+			app_info.apiVersion = VK_API_VERSION_1_3;
+			session->dynamic_rendering = true;
+		}
+	}
 	
     VkInstanceCreateInfo create_info = {0};
     create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -162,6 +177,12 @@ void select_physical_device(VkSession *session){
 		if(!has_graphics_queue(physical_devices[i])){
 			continue;
 		}
+		if(session->headless){
+			// offscreen rendering needs neither a surface nor the swapchain extension
+			session->physical_device = physical_devices[i];
+			free(physical_devices);
+			return;
+		}
 		if(!has_present_queue(physical_devices[i], session->surface)){
 			continue;
 		}
@@ -179,6 +200,27 @@ void select_physical_device(VkSession *session){
 	printf("No suitable physical device was found.\n");
 }
 
+/**
+ * The 8 bit color format is always there for vertex buffers, the scaled 16 bit positions are optional
+ * and only hold layouts of up to 65535 pixels in each direction. The layout is as large as the configured window.
+ */
+void check_compact_vertex_support(VkConfig *config, VkSession *session){
+	if(!session->compact_vertices){
+		return;
+	}
+	if(config->width > UINT16_MAX || config->height > UINT16_MAX){
+		printf("The layout is too large for 16 bit vertex positions, using float vertices.\n");
+		session->compact_vertices = false;
+		return;
+	}
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties(session->physical_device, VK_FORMAT_R16G16_USCALED, &properties);
+	if((properties.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT) == 0){
+		printf("16 bit vertex positions are not supported, using float vertices.\n");
+		session->compact_vertices = false;
+	}
+}
+
 void create_logical_device(VkConfig *config, VkSession *session){
 	uint32_t count = 0;
 	vkGetPhysicalDeviceQueueFamilyProperties(session->physical_device, &count, NULL);
@@ -198,12 +240,31 @@ void create_logical_device(VkConfig *config, VkSession *session){
 		if((properties[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0){
 			session->graphics_queue_index = i;			
 		}
+		if(session->headless){
+			continue;
+		}
 		vkGetPhysicalDeviceSurfaceSupportKHR(session->physical_device, i, session->surface, &supports_presenting);
 		if(supports_presenting){	
 			session->present_queue_index = i;	
 		}
 	}
+	// prefer a family that only transfers, which usually maps to a dedicated copy engine
+	session->transfer_queue_index = session->graphics_queue_index;
+	bool dedicated_transfer = false;
+	for(uint32_t i = 0; i < count; i++){
+		VkQueueFlags flags = properties[i].queueFlags;
+		if((flags & VK_QUEUE_TRANSFER_BIT) == 0 || (flags & VK_QUEUE_GRAPHICS_BIT) != 0){
+			continue;
+		}
+		if(!dedicated_transfer || (flags & VK_QUEUE_COMPUTE_BIT) == 0){
+			session->transfer_queue_index = i;
+			dedicated_transfer = (flags & VK_QUEUE_COMPUTE_BIT) == 0;
+		}
+	}
 	free(properties);
+	if(session->headless){
+		session->present_queue_index = session->graphics_queue_index;
+	}
 	if(session->graphics_queue_index == UINT32_MAX){
 		printf("No graphics queue was found.\n");
 		abort();
@@ -214,33 +275,68 @@ void create_logical_device(VkConfig *config, VkSession *session){
 	}
 
 	float priority = 1.0f;		
-	bool queue_shared = session->graphics_queue_index == session->present_queue_index;
-	int queue_count = queue_shared ? 1 : 2;
-	VkDeviceQueueCreateInfo *queue_infos = malloc(sizeof(VkDeviceQueueCreateInfo) * queue_count);
-	queue_infos[0] = (VkDeviceQueueCreateInfo){
-		.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-		.queueFamilyIndex = session->graphics_queue_index,
-		.queueCount = 1,
-		.pQueuePriorities = &priority
-	};
-	if(!queue_shared){	
-		queue_infos[1] = (VkDeviceQueueCreateInfo){
+	uint32_t families[] = {session->graphics_queue_index, session->present_queue_index, session->transfer_queue_index};
+	int queue_count = 0;
+	VkDeviceQueueCreateInfo *queue_infos = malloc(sizeof(VkDeviceQueueCreateInfo) * 3);
+	for(int i = 0; i < 3; i++){
+		bool seen = false;
+		for(int j = 0; j < i; j++){
+			seen = seen || families[j] == families[i];
+		}
+		if(seen){
+			continue;
+		}
+		queue_infos[queue_count++] = (VkDeviceQueueCreateInfo){
 			.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-			.queueFamilyIndex = session->present_queue_index,
+			.queueFamilyIndex = families[i],
 			.queueCount = 1,
 			.pQueuePriorities = &priority
 		};
 	}
 	
+	VkPhysicalDeviceFeatures supported_features = {0};
+	vkGetPhysicalDeviceFeatures(session->physical_device, &supported_features);
 	VkPhysicalDeviceFeatures device_features = {0};
+	device_features.pipelineStatisticsQuery = config->pipeline_statistics && supported_features.pipelineStatisticsQuery;
+	session->pipeline_statistics = device_features.pipelineStatisticsQuery;
+
+	VkPhysicalDeviceDynamicRenderingFeatures dynamic_rendering_features = {0};
+	dynamic_rendering_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+	if(session->dynamic_rendering){
+		VkPhysicalDeviceProperties device_properties;
+		vkGetPhysicalDeviceProperties(session->physical_device, &device_properties);
+		if(device_properties.apiVersion >= VK_API_VERSION_1_3){
+			VkPhysicalDeviceFeatures2 features = {0};
+			features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+			features.pNext = &dynamic_rendering_features;
+			vkGetPhysicalDeviceFeatures2(session->physical_device, &features);
+		}
+		session->dynamic_rendering = dynamic_rendering_features.dynamicRendering;
+	}
+	if(config->dynamic_rendering && !session->dynamic_rendering){
+		printf("Dynamic rendering is not supported, using a render pass.\n");
+	}
 
 	VkDeviceCreateInfo create_info = {0};
 	create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	create_info.pNext = session->dynamic_rendering ? &dynamic_rendering_features : NULL;
 	create_info.pQueueCreateInfos = queue_infos;
 	create_info.queueCreateInfoCount = queue_count;
 	create_info.pEnabledFeatures = &device_features;
-	create_info.enabledExtensionCount = extension_count;
-	create_info.ppEnabledExtensionNames = extensions;
+	// incremental present only tells the compositor what changed, so it is enabled whenever it is there
+	const char *incremental_present[] = {VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME};
+	session->incremental_present = session->damage_rendering && !session->headless && supports_extensions(session->physical_device, incremental_present, 1);
+	const char *device_extensions[8];
+	assert(extension_count < 8);
+	int device_extension_count = 0;
+	for(int i = 0; i < extension_count; i++){
+		device_extensions[device_extension_count++] = extensions[i];
+	}
+	if(session->incremental_present){
+		device_extensions[device_extension_count++] = incremental_present[0];
+	}
+	create_info.enabledExtensionCount = session->headless ? 0 : device_extension_count;
+	create_info.ppEnabledExtensionNames = session->headless ? NULL : device_extensions;
 	if(config->enable_validation_layers){
 		create_info.enabledLayerCount = validation_layer_count;
 		create_info.ppEnabledLayerNames = validation_layers;
@@ -254,17 +350,21 @@ void create_logical_device(VkConfig *config, VkSession *session){
 	}
 	vkGetDeviceQueue(session->logical_device, session->graphics_queue_index, 0, &session->graphics_queue);
 	vkGetDeviceQueue(session->logical_device, session->present_queue_index, 0, &session->present_queue);
+	vkGetDeviceQueue(session->logical_device, session->transfer_queue_index, 0, &session->transfer_queue);
 }
 
-void create_swapchain(VkSession *session)
+void create_swapchain(VkSession *session, VkSwapchainKHR old_swapchain)
 {
 	VkSurfaceCapabilitiesKHR capabilities= {0};
 	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(session->physical_device, session->surface, &capabilities);
 
-	session->image_count = capabilities.minImageCount + 1;
-	if(capabilities.maxImageCount != 0 && session->image_count > capabilities.maxImageCount){
+	session->image_count = session->requested_image_count != 0 ? session->requested_image_count : capabilities.minImageCount + 1;
+	if(session->image_count < capabilities.minImageCount){
 		session->image_count = capabilities.minImageCount;
 	}
+	if(capabilities.maxImageCount != 0 && session->image_count > capabilities.maxImageCount){
+		session->image_count = capabilities.maxImageCount;
+	}
 	if(capabilities.currentExtent.width != UINT32_MAX){
 		session->image_extent = capabilities.currentExtent;
 	}else{
@@ -297,13 +397,36 @@ void create_swapchain(VkSession *session)
 	VkPresentModeKHR *present_modes = malloc(sizeof(VkPresentModeKHR) * present_mode_count);
 	vkGetPhysicalDeviceSurfacePresentModesKHR(session->physical_device, session->surface, &present_mode_count, present_modes);
 	
-	VkPresentModeKHR present_mode = present_modes[0];
-	for(uint32_t i = 0; i < present_mode_count; i++){
-		if(present_modes[i] == VK_PRESENT_MODE_FIFO_KHR){
-			present_mode = VK_PRESENT_MODE_FIFO_KHR;	
+	// the preferred mode first, FIFO last since it is always supported
+	VkPresentModeKHR preferences[3] = {VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_KHR};
+	switch(session->preferred_present_mode){
+		case AURORA_PRESENT_MODE_MAILBOX:
+			preferences[0] = VK_PRESENT_MODE_MAILBOX_KHR;
+			preferences[1] = VK_PRESENT_MODE_IMMEDIATE_KHR;
+			break;
+		case AURORA_PRESENT_MODE_IMMEDIATE:
+			preferences[0] = VK_PRESENT_MODE_IMMEDIATE_KHR;
+			preferences[1] = VK_PRESENT_MODE_MAILBOX_KHR;
+			break;
+		case AURORA_PRESENT_MODE_FIFO_RELAXED:
+			preferences[0] = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
 			break;
+		case AURORA_PRESENT_MODE_FIFO:
+			break;
+	}
+	VkPresentModeKHR present_mode = present_modes[0];
+	bool found = false;
+	for(int p = 0; p < 3 && !found; p++){
+		for(uint32_t i = 0; i < present_mode_count; i++){
+			if(present_modes[i] == preferences[p]){
+				present_mode = preferences[p];
+				found = true;
+				break;
+			}
 		}
 	}
+	free(present_modes);
+	session->present_mode = present_mode;
 	
 	VkSwapchainCreateInfoKHR create_info = {0}; 
 	create_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
@@ -331,7 +454,7 @@ void create_swapchain(VkSession *session)
 	create_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 	create_info.presentMode = present_mode;
 	create_info.clipped = VK_TRUE;
-	create_info.oldSwapchain = VK_NULL_HANDLE;
+	create_info.oldSwapchain = old_swapchain;
 	if(vkCreateSwapchainKHR(session->logical_device, &create_info, NULL, &session->swapchain) != VK_SUCCESS){
 		printf("Swapchain creation failed.\n");
 		abort();
@@ -342,9 +465,10 @@ void create_swapchain(VkSession *session)
 		printf("No images in the swapchain.\n");
 		abort();
 	}
-	printf("%u\n", count);
 	session->images = malloc(sizeof(VkImage) * count);
 	vkGetSwapchainImagesKHR(session->logical_device, session->swapchain, &count, session->images);
+	// minImageCount is only a lower bound, everything indexed by image has to be sized by what we got
+	session->image_count = count;
 }
 
 void create_image_views(VkSession *session){
@@ -372,16 +496,22 @@ void create_image_views(VkSession *session){
 }
 
 
-void create_render_pass(VkSession *session){
+/**
+ * The retaining variant loads what the image was last presented with instead of clearing it. Load ops and
+ * layouts do not matter for compatibility, so the pipeline and the framebuffers work with both.
+ */
+VkRenderPass build_render_pass(VkSession *session, bool retain){
+	// offscreen images are left ready to be copied out instead of presented
+	VkImageLayout final_layout = session->headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 	VkAttachmentDescription color_attachment = {0};
 	color_attachment.format = session->image_format.format;
 	color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
-	color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	color_attachment.loadOp = retain ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
 	color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	color_attachment.initialLayout = retain ? final_layout : VK_IMAGE_LAYOUT_UNDEFINED;
+	color_attachment.finalLayout = final_layout;
 	
 	VkAttachmentReference color_attachment_reference = {0};
 	color_attachment_reference.attachment = 0; // fragment shader index location = 0
@@ -398,7 +528,7 @@ void create_render_pass(VkSession *session){
 	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 	dependency.srcAccessMask = 0;	
 	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | (retain ? VK_ACCESS_COLOR_ATTACHMENT_READ_BIT : 0);
 
 	VkRenderPassCreateInfo render_pass_create_info = {0};
 	render_pass_create_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -408,17 +538,31 @@ void create_render_pass(VkSession *session){
 	render_pass_create_info.pSubpasses = &subpass;
 	render_pass_create_info.dependencyCount = 1;
 	render_pass_create_info.pDependencies = &dependency;
-	if(vkCreateRenderPass(session->logical_device, &render_pass_create_info, NULL, &session->render_pass)){
+	VkRenderPass render_pass;
+	if(vkCreateRenderPass(session->logical_device, &render_pass_create_info, NULL, &render_pass)){
 		printf("Failed to create a render pass.\n");
 		abort();
 	}
+	return render_pass;
+}
+
+void create_render_pass(VkSession *session){
+	session->render_pass = VK_NULL_HANDLE;
+	session->load_render_pass = VK_NULL_HANDLE;
+	if(session->dynamic_rendering){
+		return;
+	}
+	session->render_pass = build_render_pass(session, false);
+	if(session->damage_rendering){
+		session->load_render_pass = build_render_pass(session, true);
+	}
 }
 
-VkShaderModule create_shader_module(VkSession *session, char* code, size_t length){
+VkShaderModule create_shader_module(VkSession *session, const uint32_t* code, size_t length){
 	VkShaderModuleCreateInfo create_info = {0};
 	create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
 	create_info.codeSize = length;
-	create_info.pCode = (uint32_t*)code; // align the char* to uint32_t (so, 4x the space from 1 byte to 4 bytes)
+	create_info.pCode = code;
 	VkShaderModule shader_module;
 	if(vkCreateShaderModule(session->logical_device, &create_info, NULL, &shader_module) != VK_SUCCESS){
 		return NULL;
@@ -426,15 +570,50 @@ VkShaderModule create_shader_module(VkSession *session, char* code, size_t lengt
 	return shader_module;
 }
 
-VkVertexInputBindingDescription get_binding_description(){
+VkDeviceSize get_vertex_size(VkSession *session){
+	return session->compact_vertices ? sizeof(CompactVertex) : sizeof(Vertex);
+}
+VkVertexInputBindingDescription get_binding_description(VkSession *session){
 	VkVertexInputBindingDescription description = {0};
 	description.binding = 0;
-	description.stride = sizeof(Vertex);
+	if(session->instanced){
+		description.stride = sizeof(RectInstance);
+		description.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+		return description;
+	}
+	description.stride = (uint32_t)get_vertex_size(session);
 	description.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
 	return description;
 }
 
-VkVertexInputAttributeDescription* get_attribute_descriptions(){
+VkVertexInputAttributeDescription* get_instance_attribute_descriptions(uint32_t *count){
+	VkVertexInputAttributeDescription* attribute_descriptions = malloc(sizeof(VkVertexInputAttributeDescription) * 3);
+	attribute_descriptions[0] = (VkVertexInputAttributeDescription){
+		.location = 0,
+		.binding = 0,
+		.format = VK_FORMAT_R32G32_SFLOAT,
+		.offset = offsetof(RectInstance, position)
+	};
+	attribute_descriptions[1] = (VkVertexInputAttributeDescription){
+		.location = 1,
+		.binding = 0,
+		.format = VK_FORMAT_R32G32_SFLOAT,
+		.offset = offsetof(RectInstance, size)
+	};
+	attribute_descriptions[2] = (VkVertexInputAttributeDescription){
+		.location = 2,
+		.binding = 0,
+		.format = VK_FORMAT_R32G32B32_SFLOAT,
+		.offset = offsetof(RectInstance, color)
+	};
+	*count = 3;
+	return attribute_descriptions;
+}
+
+VkVertexInputAttributeDescription* get_attribute_descriptions(VkSession *session, uint32_t *count){
+	if(session->instanced){
+		return get_instance_attribute_descriptions(count);
+	}
 	VkVertexInputAttributeDescription description1 = {
 		.location = 0,
 		.binding = 0,
@@ -448,20 +627,110 @@ VkVertexInputAttributeDescription* get_attribute_descriptions(){
 		.format = VK_FORMAT_R32G32B32_SFLOAT,
 		.offset = offsetof(Vertex, color)
 	};
+	if(session->compact_vertices){
+		// scaled and normalized formats arrive as floats, so the same shader reads both layouts
+		description1.format = VK_FORMAT_R16G16_USCALED;
+		description1.offset = offsetof(CompactVertex, position);
+		description2.format = VK_FORMAT_R8G8B8A8_UNORM;
+		description2.offset = offsetof(CompactVertex, color);
+	}
 	
 	VkVertexInputAttributeDescription* attribute_descriptions = malloc(sizeof(VkVertexInputAttributeDescription) * 2);
 	attribute_descriptions[0] = description1;
 	attribute_descriptions[1] = description2;
+	*count = 2;
 	return attribute_descriptions;
 }
 
+/**
+ * The driver writes a VkPipelineCacheHeaderVersionOne in front of its data, a file written by another
+ * driver or device is ignored instead of being handed to vkCreatePipelineCache.
+ */
+bool pipeline_cache_matches_device(VkSession *session, char *data, size_t length){
+	VkPipelineCacheHeaderVersionOne header;
+	if(length < sizeof(header)){
+		return false;
+	}
+	memcpy(&header, data, sizeof(header));
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(session->physical_device, &properties);
+	return header.headerSize >= sizeof(header)
+		&& header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+		&& header.vendorID == properties.vendorID
+		&& header.deviceID == properties.deviceID
+		&& memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void create_pipeline_cache(VkConfig *config, VkSession *session){
+	session->pipeline_cache_path = config->pipeline_cache_path;
+	size_t length = 0;
+	char *data = NULL;
+	if(session->pipeline_cache_path != NULL){
+		data = try_read_file(session->pipeline_cache_path, &length);
+	}
+	VkPipelineCacheCreateInfo create_info = {0};
+	create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	if(data != NULL && pipeline_cache_matches_device(session, data, length)){
+		create_info.initialDataSize = length;
+		create_info.pInitialData = data;
+	}
+	VkResult result = vkCreatePipelineCache(session->logical_device, &create_info, NULL, &session->pipeline_cache);
+	if(result != VK_SUCCESS && create_info.initialDataSize > 0){
+		// a corrupt cache is not worth failing over, start from an empty one
+		create_info.initialDataSize = 0;
+		create_info.pInitialData = NULL;
+		result = vkCreatePipelineCache(session->logical_device, &create_info, NULL, &session->pipeline_cache);
+	}
+	assert(result == VK_SUCCESS);
+	free(data);
+}
+
+void save_pipeline_cache(VkSession *session){
+	if(session->pipeline_cache_path == NULL){
+		return;
+	}
+	size_t length = 0;
+	VkResult result = vkGetPipelineCacheData(session->logical_device, session->pipeline_cache, &length, NULL);
+	if(result != VK_SUCCESS || length == 0){
+		return;
+	}
+	char *data = malloc(length);
+	assert(data != NULL);
+	result = vkGetPipelineCacheData(session->logical_device, session->pipeline_cache, &length, data);
+	if(result == VK_SUCCESS && !try_write_file(session->pipeline_cache_path, data, length)){
+		printf("Could not write the pipeline cache to %s.\n", session->pipeline_cache_path);
+	}
+	free(data);
+}
+
+/**
+ * Creates the module from the file at path if one was configured, otherwise from the embedded SPIR-V.
+ */
+VkShaderModule load_shader_module(VkSession *session, char *path, const uint32_t *embedded, size_t embedded_length){
+	if(path == NULL){
+		return create_shader_module(session, embedded, embedded_length);
+	}
+	size_t length = 0;
+	char *code = try_read_file(path, &length);
+	if(code == NULL || length % sizeof(uint32_t) != 0){
+		printf("Could not load the SPIR-V module %s.\n", path);
+		abort();
+	}
+	// malloc'd memory is aligned for any type, so the words can be used in place
+	VkShaderModule shader_module = create_shader_module(session, (const uint32_t*)code, length);
+	free(code);
+	return shader_module;
+}
+
 void create_graphics_pipeline(VkSession *session){
-	size_t vert_shader_length = fetch_file_size("D:/vulkan-vs/shader/vert.spv");
-	char *vert_shader_code = read_file("D:/vulkan-vs/shader/vert.spv", vert_shader_length);
-	size_t frag_shader_length = fetch_file_size("D:/vulkan-vs/shader/frag.spv");
-	char *frag_shader_code = read_file("D:/vulkan-vs/shader/frag.spv", frag_shader_length);
-	VkShaderModule vertex_shader_module = create_shader_module(session, vert_shader_code, vert_shader_length);
-	VkShaderModule fragment_shader_module = create_shader_module(session, frag_shader_code, frag_shader_length);
+	VkShaderModule vertex_shader_module = session->instanced
+		? load_shader_module(session, session->vertex_shader, instanced_vert_spv, sizeof(instanced_vert_spv))
+		: load_shader_module(session, session->vertex_shader, vert_spv, sizeof(vert_spv));
+	VkShaderModule fragment_shader_module = load_shader_module(session, session->fragment_shader, frag_spv, sizeof(frag_spv));
+	if(vertex_shader_module == NULL || fragment_shader_module == NULL){
+		printf("Shader module creation failed.\n");
+		abort();
+	}
 	
 	VkPipelineShaderStageCreateInfo vertex_shader_create_info = {0};
 	vertex_shader_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -477,18 +746,20 @@ void create_graphics_pipeline(VkSession *session){
 	
 	VkPipelineShaderStageCreateInfo shader_stage_create_infos[] = {vertex_shader_create_info, fragment_shader_create_info};	
 	
-	VkVertexInputBindingDescription binding_description = get_binding_description();
-	VkVertexInputAttributeDescription* attribute_descriptions = get_attribute_descriptions();
+	VkVertexInputBindingDescription binding_description = get_binding_description(session);
+	uint32_t attribute_count = 0;
+	VkVertexInputAttributeDescription* attribute_descriptions = get_attribute_descriptions(session, &attribute_count);
 	VkPipelineVertexInputStateCreateInfo vertex_input_info = {0};
 	vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 	vertex_input_info.vertexBindingDescriptionCount = 1;
 	vertex_input_info.pVertexBindingDescriptions = &binding_description;
-	vertex_input_info.vertexAttributeDescriptionCount = 2;
+	vertex_input_info.vertexAttributeDescriptionCount = attribute_count;
 	vertex_input_info.pVertexAttributeDescriptions = attribute_descriptions;
 	
 	VkPipelineInputAssemblyStateCreateInfo input_assembly_create_info = {0};
 	input_assembly_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-	input_assembly_create_info.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	// an instance is drawn as a four vertex strip: top left, top right, bottom left, bottom right
+	input_assembly_create_info.topology = session->instanced ? VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP : VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 	input_assembly_create_info.primitiveRestartEnable = VK_FALSE;
 	
 	VkViewport viewport = {0};
@@ -566,8 +837,12 @@ void create_graphics_pipeline(VkSession *session){
 	pipeline_layout_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipeline_layout_create_info.setLayoutCount = 0; 
 	pipeline_layout_create_info.pSetLayouts = NULL;
-	pipeline_layout_create_info.pushConstantRangeCount = 0;
-	pipeline_layout_create_info.pPushConstantRanges = NULL;
+	VkPushConstantRange view_range = {0};
+	view_range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	view_range.offset = 0;
+	view_range.size = sizeof(ViewTransform);
+	pipeline_layout_create_info.pushConstantRangeCount = 1;
+	pipeline_layout_create_info.pPushConstantRanges = &view_range;
 	VkResult result = vkCreatePipelineLayout(session->logical_device, &pipeline_layout_create_info, NULL, &session->pipeline_layout);
 	assert(result == VK_SUCCESS);
 
@@ -586,10 +861,18 @@ void create_graphics_pipeline(VkSession *session){
 	graphics_pipeline_create_info.layout = session->pipeline_layout;
 	graphics_pipeline_create_info.renderPass = session->render_pass;
 	graphics_pipeline_create_info.subpass = 0;
+	// without a render pass the pipeline only needs to know the attachment format
+	VkPipelineRenderingCreateInfo rendering_create_info = {0};
+	rendering_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+	rendering_create_info.colorAttachmentCount = 1;
+	rendering_create_info.pColorAttachmentFormats = &session->image_format.format;
+	if(session->dynamic_rendering){
+		graphics_pipeline_create_info.pNext = &rendering_create_info;
+	}
 	graphics_pipeline_create_info.basePipelineHandle = VK_NULL_HANDLE;
 	graphics_pipeline_create_info.basePipelineIndex = -1;
 
-	result = vkCreateGraphicsPipelines(session->logical_device, VK_NULL_HANDLE, 1, &graphics_pipeline_create_info, NULL, &session->graphics_pipeline);
+	result = vkCreateGraphicsPipelines(session->logical_device, session->pipeline_cache, 1, &graphics_pipeline_create_info, NULL, &session->graphics_pipeline);
 	assert(result == VK_SUCCESS);
 	free(attribute_descriptions);
 	vkDestroyShaderModule(session->logical_device, fragment_shader_module, NULL);
@@ -598,6 +881,10 @@ void create_graphics_pipeline(VkSession *session){
 
 
 void create_framebuffers(VkSession *session){
+	if(session->dynamic_rendering){
+		session->frame_buffers = NULL;
+		return;
+	}
 	session->frame_buffers = malloc(sizeof(VkFramebuffer) * session->image_count);
 	for(size_t i = 0; i < session->image_count; i++){
 		VkImageView image_view = session->image_views[i];
@@ -624,61 +911,336 @@ void create_command_pool(VkSession *session){
 	assert(result == VK_SUCCESS);
 }
 
+/**
+ * One command buffer per frame slot and swapchain image, at frame * image_count + image.
+ * With damage rendering a second set follows, which draws nothing and is submitted for images without damage.
+ */
+uint32_t get_command_buffer_count(VkSession *session){
+	uint32_t count = session->frames_in_flight * session->image_count;
+	return session->damage_rendering ? count * 2 : count;
+}
+
+/**
+ * They are recorded the first time they are needed and then resubmitted as is until invalidated.
+ */
 void allocate_command_buffers(VkSession *session){
-	session->command_buffers = malloc(sizeof(VkCommandBuffer) * MAX_FRAMES_IN_FLIGHT);
+	uint32_t count = get_command_buffer_count(session);
+	session->command_buffers = malloc(sizeof(VkCommandBuffer) * count);
+	session->command_buffers_valid = calloc(count, sizeof(bool));
+	assert(session->command_buffers != NULL && session->command_buffers_valid != NULL);
 	VkCommandBufferAllocateInfo info = {0};
 	info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	info.commandPool = session->command_pool;
 	info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	info.commandBufferCount = MAX_FRAMES_IN_FLIGHT;
+	info.commandBufferCount = count;
 	VkResult result = vkAllocateCommandBuffers(session->logical_device, &info, &session->command_buffers[0]);
 	assert(result == VK_SUCCESS);
 }
 
+void create_damage_regions(VkSession *session){
+	session->image_damage = NULL;
+	session->present_damage = (DamageRegion){ .full = true };
+	if(!session->damage_rendering){
+		return;
+	}
+	session->image_damage = malloc(sizeof(DamageRegion) * session->image_count);
+	assert(session->image_damage != NULL);
+	for(uint32_t i = 0; i < session->image_count; i++){
+		session->image_damage[i] = (DamageRegion){ .full = true };
+	}
+}
+
+VkRect2D get_damage_bounds(DamageRegion *damage){
+	if(damage->count == 0){
+		return (VkRect2D){0};
+	}
+	int32_t left = damage->rects[0].offset.x;
+	int32_t top = damage->rects[0].offset.y;
+	int32_t right = left + (int32_t)damage->rects[0].extent.width;
+	int32_t bottom = top + (int32_t)damage->rects[0].extent.height;
+	for(uint32_t i = 1; i < damage->count; i++){
+		VkRect2D *rect = &damage->rects[i];
+		if(rect->offset.x < left) left = rect->offset.x;
+		if(rect->offset.y < top) top = rect->offset.y;
+		if(rect->offset.x + (int32_t)rect->extent.width > right) right = rect->offset.x + (int32_t)rect->extent.width;
+		if(rect->offset.y + (int32_t)rect->extent.height > bottom) bottom = rect->offset.y + (int32_t)rect->extent.height;
+	}
+	return (VkRect2D){ .offset = {left, top}, .extent = {(uint32_t)(right - left), (uint32_t)(bottom - top)} };
+}
+
+void add_damage_rect(DamageRegion *damage, VkRect2D rect){
+	if(damage->full){
+		return;
+	}
+	if(damage->count == MAX_DAMAGE_RECTS){
+		damage->rects[0] = get_damage_bounds(damage);
+		damage->count = 1;
+	}
+	damage->rects[damage->count++] = rect;
+}
+
+/**
+ * Marks every image as having nothing worth keeping, the next frame drawn into each clears and draws all of it.
+ */
+void vulkan_session_damage_all(VkSession *session){
+	session->present_damage.full = true;
+	if(session->image_damage == NULL){
+		return;
+	}
+	for(uint32_t i = 0; i < session->image_count; i++){
+		session->image_damage[i].full = true;
+	}
+}
+
+ViewTransform get_view_transform(float x, float y, float width, float height){
+	ViewTransform view;
+	view.scale = (vec2s){ .x = 2.0f / width, .y = 2.0f / height };
+	view.offset = (vec2s){ .x = -1.0f - x * view.scale.x, .y = -1.0f - y * view.scale.y };
+	return view;
+}
+
+/**
+ * Damages the pixels covered by a rectangle in normalized device coordinates. It is rounded outwards by a pixel,
+ * drawing a bit more is harmless as everything inside the scissor is drawn again.
+ */
+void damage_area(VkSession *session, float left, float top, float right, float bottom){
+	if(session->image_damage == NULL){
+		return;
+	}
+	float width = (float)session->image_extent.width;
+	float height = (float)session->image_extent.height;
+	int32_t x0 = (int32_t)floorf((left + 1.0f) * 0.5f * width) - 1;
+	int32_t y0 = (int32_t)floorf((top + 1.0f) * 0.5f * height) - 1;
+	int32_t x1 = (int32_t)ceilf((right + 1.0f) * 0.5f * width) + 1;
+	int32_t y1 = (int32_t)ceilf((bottom + 1.0f) * 0.5f * height) + 1;
+	if(x0 < 0) x0 = 0;
+	if(y0 < 0) y0 = 0;
+	if(x1 > (int32_t)session->image_extent.width) x1 = (int32_t)session->image_extent.width;
+	if(y1 > (int32_t)session->image_extent.height) y1 = (int32_t)session->image_extent.height;
+	if(x1 <= x0 || y1 <= y0){
+		return;
+	}
+	VkRect2D rect = { .offset = {x0, y0}, .extent = {(uint32_t)(x1 - x0), (uint32_t)(y1 - y0)} };
+	for(uint32_t i = 0; i < session->image_count; i++){
+		add_damage_rect(&session->image_damage[i], rect);
+	}
+	add_damage_rect(&session->present_damage, rect);
+}
+
+/**
+ * The patched leaves of a split together cover the leaf that was split, so their rectangles are all that changed.
+ */
+void damage_patches(VkSession *session, LeafPatch *patches, size_t patch_count){
+	vec2s scale = session->view.scale;
+	vec2s offset = session->view.offset;
+	for(size_t i = 0; i < patch_count; i++){
+		if(session->instanced){
+			RectInstance *instance = &patches[i].instance;
+			damage_area(session, instance->position.x * scale.x + offset.x, instance->position.y * scale.y + offset.y,
+				(instance->position.x + instance->size.x) * scale.x + offset.x, (instance->position.y + instance->size.y) * scale.y + offset.y);
+			continue;
+		}
+		Vertex *vertices = patches[i].vertices;
+		float left = vertices[0].position.x, right = vertices[0].position.x;
+		float top = vertices[0].position.y, bottom = vertices[0].position.y;
+		for(int v = 1; v < VERTICES_PER_LEAF; v++){
+			left = fminf(left, vertices[v].position.x);
+			right = fmaxf(right, vertices[v].position.x);
+			top = fminf(top, vertices[v].position.y);
+			bottom = fmaxf(bottom, vertices[v].position.y);
+		}
+		damage_area(session, left * scale.x + offset.x, top * scale.y + offset.y, right * scale.x + offset.x, bottom * scale.y + offset.y);
+	}
+}
+
+void transition_image(VkCommandBuffer command_buffer, VkImage image, VkImageLayout old_layout, VkImageLayout new_layout, VkPipelineStageFlags src_stage, VkAccessFlags src_access, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access){
+	VkImageMemoryBarrier barrier = {0};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = src_access;
+	barrier.dstAccessMask = dst_access;
+	barrier.oldLayout = old_layout;
+	barrier.newLayout = new_layout;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	vkCmdPipelineBarrier(command_buffer, src_stage, dst_stage, 0, 0, NULL, 0, NULL, 1, &barrier);
+}
+
+/**
+ * Does by hand what the render pass does: the barrier stands in for the external subpass dependency, it starts at
+ * the color output stage the acquire semaphore is waited on, so the layout change happens after the image is acquired.
+ */
+void begin_rendering(VkSession *session, VkCommandBuffer command_buffer, uint32_t image_index, VkClearValue clear_color, bool retain, VkRect2D render_area){
+	VkImageLayout old_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+	VkAccessFlags access = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	if(retain){
+		old_layout = session->headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		access |= VK_ACCESS_COLOR_ATTACHMENT_READ_BIT;
+	}
+	transition_image(command_buffer, session->images[image_index], old_layout, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, access);
+	VkRenderingAttachmentInfo color_attachment = {0};
+	color_attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+	color_attachment.imageView = session->image_views[image_index];
+	color_attachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	color_attachment.loadOp = retain ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_CLEAR;
+	color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	color_attachment.clearValue = clear_color;
+	VkRenderingInfo rendering_info = {0};
+	rendering_info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+	rendering_info.renderArea = render_area;
+	rendering_info.layerCount = 1;
+	rendering_info.colorAttachmentCount = 1;
+	rendering_info.pColorAttachments = &color_attachment;
+	vkCmdBeginRendering(command_buffer, &rendering_info);
+}
 
-void record_command_buffer(VkSession *session, uint32_t image_index){
+void end_rendering(VkSession *session, VkCommandBuffer command_buffer, uint32_t image_index){
+	vkCmdEndRendering(command_buffer);
+	// offscreen images are left ready to be copied out instead of presented
+	VkImageLayout final_layout = session->headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	transition_image(command_buffer, session->images[image_index], VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, final_layout,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0);
+}
+
+/**
+ * Without damage the whole image is cleared and drawn. With it the image keeps what it was last presented with and
+ * only the damaged rectangles are drawn again, each with its own scissor; nothing changed means no render pass at all.
+ */
+void record_command_buffer(VkSession *session, VkCommandBuffer command_buffer, uint32_t frame, uint32_t image_index, DamageRegion *damage){
 	VkCommandBufferBeginInfo begin_info = {0};
 	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 	begin_info.flags = 0;
 	begin_info.pInheritanceInfo = NULL;
-	VkResult result = vkBeginCommandBuffer(session->command_buffers[current_frame], &begin_info);
+	VkResult result = vkBeginCommandBuffer(command_buffer, &begin_info);
 	assert(result == VK_SUCCESS);
-	VkRenderPassBeginInfo render_pass_info = {0};
-	render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	render_pass_info.renderPass = session->render_pass;
-	render_pass_info.framebuffer = session->frame_buffers[image_index];
-	render_pass_info.renderArea.offset = (VkOffset2D){0, 0};
-	render_pass_info.renderArea.extent = session->image_extent;
 	VkClearValue clear_color = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
-	render_pass_info.clearValueCount = 1;
-	render_pass_info.pClearValues = &clear_color;
-	vkCmdBeginRenderPass(session->command_buffers[current_frame], &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
-	vkCmdBindPipeline(session->command_buffers[current_frame], VK_PIPELINE_BIND_POINT_GRAPHICS, session->graphics_pipeline);
-	
-	VkViewport viewport = {0};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = session->image_extent.width; // todo
-	viewport.height = session->image_extent.height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
-	vkCmdSetViewport(session->command_buffers[current_frame], 0, 1, &viewport);
-	VkRect2D scissor = {0};
-	scissor.offset = (VkOffset2D){0, 0};
-	scissor.extent = session->image_extent;
-	vkCmdSetScissor(session->command_buffers[current_frame], 0, 1, &scissor);
-	
-	VkBuffer vertex_buffers[] = {session->vertex_buffer};
-	VkDeviceSize offsets[] = {0};
-	vkCmdBindVertexBuffers(session->command_buffers[current_frame], 0, 1, vertex_buffers, offsets);
-	vkCmdBindIndexBuffer(session->command_buffers[current_frame], session->index_buffer, 0, VK_INDEX_TYPE_UINT16);
-	vkCmdDrawIndexed(session->command_buffers[current_frame], session->index_count, 1, 0, 0, 0);
-	
-	vkCmdEndRenderPass(session->command_buffers[current_frame]);
-	result = vkEndCommandBuffer(session->command_buffers[current_frame]);
+	VkRect2D full_area = { .offset = {0, 0}, .extent = session->image_extent };
+	bool retain = damage != NULL;
+	VkRect2D *scissors = retain ? damage->rects : &full_area;
+	uint32_t scissor_count = retain ? damage->count : 1;
+	VkRect2D render_area = retain ? get_damage_bounds(damage) : full_area;
+	if(session->timestamp_pool != VK_NULL_HANDLE){
+		vkCmdResetQueryPool(command_buffer, session->timestamp_pool, frame * 2, 2);
+		vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, session->timestamp_pool, frame * 2);
+	}
+	if(session->statistics_pool != VK_NULL_HANDLE){
+		vkCmdResetQueryPool(command_buffer, session->statistics_pool, frame, 1);
+		vkCmdBeginQuery(command_buffer, session->statistics_pool, frame, 0);
+	}
+	if(scissor_count > 0){
+		if(session->dynamic_rendering){
+			begin_rendering(session, command_buffer, image_index, clear_color, retain, render_area);
+		}else{
+			VkRenderPassBeginInfo render_pass_info = {0};
+			render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+			render_pass_info.renderPass = retain ? session->load_render_pass : session->render_pass;
+			render_pass_info.framebuffer = session->frame_buffers[image_index];
+			render_pass_info.renderArea = render_area;
+			render_pass_info.clearValueCount = 1;
+			render_pass_info.pClearValues = &clear_color;
+			vkCmdBeginRenderPass(command_buffer, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
+		}
+		vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, session->graphics_pipeline);
+		vkCmdPushConstants(command_buffer, session->pipeline_layout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(ViewTransform), &session->view);
+		
+		VkViewport viewport = {0};
+		viewport.x = 0.0f;
+		viewport.y = 0.0f;
+		viewport.width = session->image_extent.width; // todo
+		viewport.height = session->image_extent.height;
+		viewport.minDepth = 0.0f;
+		viewport.maxDepth = 1.0f;
+		vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+		
+		VkBuffer vertex_buffers[] = {session->vertex_buffer};
+		VkDeviceSize offsets[] = {0};
+		vkCmdBindVertexBuffers(command_buffer, 0, 1, vertex_buffers, offsets);
+		if(!session->instanced){
+			vkCmdBindIndexBuffer(command_buffer, session->index_buffer, 0, session->index_type);
+		}
+		for(uint32_t i = 0; i < scissor_count; i++){
+			vkCmdSetScissor(command_buffer, 0, 1, &scissors[i]);
+			if(session->instanced){
+				vkCmdDraw(command_buffer, 4, session->instance_count, 0, 0);
+			}else{
+				vkCmdDrawIndexed(command_buffer, session->index_count, 1, 0, 0, 0);
+			}
+		}
+		
+		if(session->dynamic_rendering){
+			end_rendering(session, command_buffer, image_index);
+		}else{
+			vkCmdEndRenderPass(command_buffer);
+		}
+	}
+	if(session->statistics_pool != VK_NULL_HANDLE){
+		vkCmdEndQuery(command_buffer, session->statistics_pool, frame);
+	}
+	if(session->timestamp_pool != VK_NULL_HANDLE){
+		vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, session->timestamp_pool, frame * 2 + 1);
+	}
+	result = vkEndCommandBuffer(command_buffer);
 	assert(result == VK_SUCCESS);	
 }
 
+void free_command_buffers(VkSession *session){
+	vkFreeCommandBuffers(session->logical_device, session->command_pool, get_command_buffer_count(session), session->command_buffers);
+	free(session->command_buffers);
+	free(session->command_buffers_valid);
+}
+
+/**
+ * Called whenever something a recorded draw refers to changes: buffers, counts, index type or the swapchain.
+ * Buffers are re-recorded lazily, after their frame slot's fence was waited on, so none of them is still pending.
+ */
+void invalidate_command_buffers(VkSession *session){
+	for(uint32_t i = 0; i < get_command_buffer_count(session); i++){
+		session->command_buffers_valid[i] = false;
+	}
+}
+
+/**
+ * Returns the command buffer for the current frame slot and the given image, recording it first if it is not valid.
+ */
+VkCommandBuffer get_command_buffer(VkSession *session, uint32_t image_index){
+	uint32_t index = current_frame * session->image_count + image_index;
+	DamageRegion *damage = session->image_damage != NULL ? &session->image_damage[image_index] : NULL;
+	if(damage != NULL && !damage->full && damage->count == 0){
+		// the image already shows everything, so the empty buffer is recorded once and reused like the full ones
+		index += session->frames_in_flight * session->image_count;
+		if(!session->command_buffers_valid[index]){
+			record_command_buffer(session, session->command_buffers[index], current_frame, image_index, damage);
+			session->command_buffers_valid[index] = true;
+		}
+	}else if(damage != NULL && !damage->full){
+		// only good for this submit, the damage is different every time
+		record_command_buffer(session, session->command_buffers[index], current_frame, image_index, damage);
+		session->command_buffers_valid[index] = false;
+	}else if(!session->command_buffers_valid[index]){
+		record_command_buffer(session, session->command_buffers[index], current_frame, image_index, NULL);
+		session->command_buffers_valid[index] = true;
+	}
+	if(damage != NULL){
+		*damage = (DamageRegion){0};
+	}
+	return session->command_buffers[index];
+}
+/**
+ * Shows the layout rectangle at x, y of width by height pixels across the whole window. The geometry stays as it is,
+ * only the command buffers are recorded again with the new push constant.
+ */
+void vulkan_session_set_view(VkSession *session, float x, float y, float width, float height){
+	session->view = get_view_transform(x, y, width, height);
+	invalidate_command_buffers(session);
+	vulkan_session_damage_all(session);
+}
+
 
 uint32_t find_memory_type(VkPhysicalDevice physical_device, uint32_t type_filter, VkMemoryPropertyFlags properties){
 	VkPhysicalDeviceMemoryProperties memory_properties;
@@ -691,137 +1253,180 @@ uint32_t find_memory_type(VkPhysicalDevice physical_device, uint32_t type_filter
 	assert(0 == 1);
 }
 
-static bool create_buffer2(VkSession* session,
-	VkDeviceSize size,
-	VkBufferUsageFlags usageFlags,
-	VkBuffer* buffer)
-{
-	VkBufferCreateInfo info = { 0 };
-	info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	info.size = size;
-	info.usage = usageFlags;
-	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-	return vkCreateBuffer(session->logical_device, &info, NULL, buffer) != VK_SUCCESS;
-}
-
-static bool allocate_memory(VkSession* session,
-	VkMemoryRequirements requirements,
-	VkMemoryPropertyFlags propertyFlags,
-	VkDeviceMemory* memory)
-{
-	VkMemoryAllocateInfo info = { 0 };
-	info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	info.allocationSize = requirements.size;
-	info.memoryTypeIndex = find_memory_type(session->physical_device, requirements.memoryTypeBits, propertyFlags);
-	return vkAllocateMemory(session->logical_device, &info, NULL, memory) != VK_SUCCESS;
+/**
+ * The headless replacement for the swapchain: one color image per frame in flight, owned by the session,
+ * so a frame never has to wait on an image another frame is still rendering to.
+ */
+void create_offscreen_images(VkConfig *config, VkSession *session){
+	session->swapchain = VK_NULL_HANDLE;
+	session->image_count = session->frames_in_flight;
+	session->image_extent = (VkExtent2D){(uint32_t)config->width, (uint32_t)config->height};
+	session->image_format = (VkSurfaceFormatKHR){VK_FORMAT_R8G8B8A8_UNORM, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR};
+	session->images = malloc(sizeof(VkImage) * session->image_count);
+	session->image_memory = malloc(sizeof(VkDeviceMemory) * session->image_count);
+	for(uint32_t i = 0; i < session->image_count; i++){
+		VkImageCreateInfo create_info = {0};
+		create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		create_info.imageType = VK_IMAGE_TYPE_2D;
+		create_info.format = session->image_format.format;
+		create_info.extent = (VkExtent3D){session->image_extent.width, session->image_extent.height, 1};
+		create_info.mipLevels = 1;
+		create_info.arrayLayers = 1;
+		create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+		create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+		create_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		if(vkCreateImage(session->logical_device, &create_info, NULL, &session->images[i]) != VK_SUCCESS){
+			printf("Offscreen image creation failed.\n");
+			abort();
+		}
+		VkMemoryRequirements requirements;
+		vkGetImageMemoryRequirements(session->logical_device, session->images[i], &requirements);
+		VkMemoryAllocateInfo alloc_info = {0};
+		alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		alloc_info.allocationSize = requirements.size;
+		alloc_info.memoryTypeIndex = find_memory_type(session->physical_device, requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		VkResult result = vkAllocateMemory(session->logical_device, &alloc_info, NULL, &session->image_memory[i]);
+		assert(result == VK_SUCCESS);
+		vkBindImageMemory(session->logical_device, session->images[i], session->image_memory[i], 0);
+	}
 }
 
+/**
+ * Buffers are placed in a block of the session's memory allocator instead of getting their own vkAllocateMemory.
+ * Host visible memory is mapped for as long as the block lives, buffer_memory->mapped points at the buffer.
+ */
 void create_buffer( VkSession *session, 
 					VkDeviceSize size, 
 					VkBufferUsageFlags usage, 
 					VkMemoryPropertyFlags properties, 
 					VkBuffer* buffer, 
-					VkDeviceMemory* buffer_memory)
+					MemoryAllocation* buffer_memory)
 {
 	VkBufferCreateInfo info = {0};
 	info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
 	info.size = size;
 	info.usage = usage;
-	info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	// buffers are written on the transfer queue and read on the graphics queue
+	uint32_t families[] = {session->graphics_queue_index, session->transfer_queue_index};
+	if(families[0] != families[1]){
+		info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		info.queueFamilyIndexCount = 2;
+		info.pQueueFamilyIndices = families;
+	}else{
+		info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	}
 	VkResult result = vkCreateBuffer(session->logical_device, &info, NULL, buffer);
 	assert(result == VK_SUCCESS);
 	VkMemoryRequirements requirements;
 	vkGetBufferMemoryRequirements(session->logical_device, *buffer, &requirements);
-	
-	VkMemoryAllocateInfo alloc_info = {0};
-	alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	alloc_info.allocationSize = requirements.size;	
-	alloc_info.memoryTypeIndex = find_memory_type(session->physical_device, requirements.memoryTypeBits, properties);
-	result = vkAllocateMemory(session->logical_device, &alloc_info, NULL, buffer_memory);
+	*buffer_memory = memory_allocate(session->allocator, requirements, properties);
+	result = vkBindBufferMemory(session->logical_device, *buffer, buffer_memory->memory, buffer_memory->offset);
 	assert(result == VK_SUCCESS);
-	vkBindBufferMemory(session->logical_device, *buffer, *buffer_memory, 0);
 }
 
-void copy_buffer(VkSession *session, VkBuffer src, VkBuffer dst, VkDeviceSize size){
-	VkCommandBufferAllocateInfo info = {0};
-	info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	info.commandPool = session->command_pool;
-	info.commandBufferCount = 1;
-	
-	VkCommandBuffer command_buffer;
-	vkAllocateCommandBuffers(session->logical_device, &info, &command_buffer);
-
-	VkCommandBufferBeginInfo begin_info = {0};
-	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-	vkBeginCommandBuffer(command_buffer, &begin_info);
-	
-	VkBufferCopy copy = {0};
-	copy.srcOffset = 0;
-	copy.dstOffset = 0;
-	copy.size = size;
-	vkCmdCopyBuffer(command_buffer, src, dst, 1, &copy);
-	vkEndCommandBuffer(command_buffer);
-	
-	VkSubmitInfo submit_info = {0};
-	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submit_info.commandBufferCount = 1;
-	submit_info.pCommandBuffers = &command_buffer;
-	vkQueueSubmit(session->graphics_queue, 1, &submit_info, VK_NULL_HANDLE);
-	vkQueueWaitIdle(session->graphics_queue);
-	vkFreeCommandBuffers(session->logical_device, session->command_pool, 1, &command_buffer);
+void destroy_buffer(VkSession *session, VkBuffer buffer, MemoryAllocation *buffer_memory){
+	vkDestroyBuffer(session->logical_device, buffer, NULL);
+	memory_free(session->allocator, buffer_memory);
 }
 
-
-void create_vertex_buffer(VkSession *session){
-	VkDeviceSize buffer_size = sizeof(Vertex) * session->vertex_count;
-
-	VkBuffer staging_buffer;
-	create_buffer2(session, buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, &staging_buffer);
-	VkMemoryRequirements requirements;
-	vkGetBufferMemoryRequirements(session->logical_device, staging_buffer, &requirements);
-	VkDeviceMemory staging_buffer_memory;
-	allocate_memory(session, requirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &staging_buffer_memory);
-	vkBindBufferMemory(session->logical_device, staging_buffer, staging_buffer_memory, 0);
-
-	void* data;
-	vkMapMemory(session->logical_device, staging_buffer_memory, 0, buffer_size, 0, &data);
-	memcpy(data, session->vertices, (size_t) buffer_size);
-	vkUnmapMemory(session->logical_device, staging_buffer_memory);
-	
-	create_buffer(session, buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 
-	  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &session->vertex_buffer, &session->vertex_buffer_memory);
-	copy_buffer(session, staging_buffer, session->vertex_buffer, buffer_size);
-
-	vkDestroyBuffer(session->logical_device, staging_buffer, NULL);
-	vkFreeMemory(session->logical_device, staging_buffer_memory, NULL);
+/**
+ * Queues the resource for destruction after the next graphics submit completes. That submit comes after every
+ * frame that could have recorded it, and it waits on any pending upload, so the copies out of it are done too.
+ */
+void retire_resource(VkSession *session, RetiredResource resource){
+	if(session->retired_count == session->retired_capacity){
+		session->retired_capacity = session->retired_capacity == 0 ? 16 : session->retired_capacity * 2;
+		session->retired = realloc(session->retired, sizeof(RetiredResource) * session->retired_capacity);
+		assert(session->retired != NULL);
+	}
+	resource.frame = session->submitted_frames + 1;
+	session->retired[session->retired_count++] = resource;
 }
 
+/**
+ * Destroys everything retired before the submit numbered completed_frame, UINT64_MAX destroys all of it.
+ */
+void destroy_retired_resources(VkSession *session, uint64_t completed_frame){
+	size_t kept = 0;
+	for(size_t i = 0; i < session->retired_count; i++){
+		RetiredResource *resource = &session->retired[i];
+		if(resource->frame > completed_frame){
+			session->retired[kept++] = *resource;
+			continue;
+		}
+		if(resource->framebuffer != VK_NULL_HANDLE){
+			vkDestroyFramebuffer(session->logical_device, resource->framebuffer, NULL);
+		}
+		if(resource->image_view != VK_NULL_HANDLE){
+			vkDestroyImageView(session->logical_device, resource->image_view, NULL);
+		}
+		if(resource->buffer != VK_NULL_HANDLE){
+			destroy_buffer(session, resource->buffer, &resource->memory);
+		}
+		if(resource->command_buffer != VK_NULL_HANDLE){
+			vkFreeCommandBuffers(session->logical_device, session->command_pool, 1, &resource->command_buffer);
+		}
+		if(resource->swapchain != VK_NULL_HANDLE){
+			vkDestroySwapchainKHR(session->logical_device, resource->swapchain, NULL);
+		}
+	}
+	session->retired_count = kept;
+}
 
-void create_index_buffer(VkSession *session){
-	VkDeviceSize buffer_size = sizeof(uint16_t) * session->index_count;
-
-	VkBuffer staging_buffer;
-	VkDeviceMemory staging_buffer_memory;
-	create_buffer(session, buffer_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &staging_buffer, &staging_buffer_memory);
-
-	void* data;
-	vkMapMemory(session->logical_device, staging_buffer_memory, 0, buffer_size, 0, &data);
-	memcpy(data, session->indices, (size_t) buffer_size);
-	vkUnmapMemory(session->logical_device, staging_buffer_memory);
-	
-	create_buffer(session, buffer_size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &session->index_buffer, &session->index_buffer_memory);
-	copy_buffer(session, staging_buffer, session->index_buffer, buffer_size);
+VkDeviceSize get_index_size(VkSession *session){
+	return session->index_type == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
 
-	vkDestroyBuffer(session->logical_device, staging_buffer, NULL);
-	vkFreeMemory(session->logical_device, staging_buffer_memory, NULL);
+/**
+ * Indices are kept as 32 bit on the cpu and only narrowed while they are written to staging memory.
+ */
+uint8_t pack_color_channel(float channel){
+	if(channel <= 0.0f) return 0;
+	if(channel >= 1.0f) return 255;
+	return (uint8_t)(channel * 255.0f + 0.5f);
+}
+void write_vertices(VkSession *session, void *destination, Vertex *vertices, size_t count){
+	if(!session->compact_vertices){
+		memcpy(destination, vertices, sizeof(Vertex) * count);
+		return;
+	}
+	CompactVertex *compact = destination;
+	for(size_t i = 0; i < count; i++){
+		// leaves never leave the layout, whose size was checked against 16 bits in check_compact_vertex_support
+		float x = vertices[i].position.x;
+		float y = vertices[i].position.y;
+		assert(x >= 0.0f && y >= 0.0f && x <= UINT16_MAX && y <= UINT16_MAX);
+		compact[i].position[0] = (uint16_t)x;
+		compact[i].position[1] = (uint16_t)y;
+		compact[i].color[0] = pack_color_channel(vertices[i].color.x);
+		compact[i].color[1] = pack_color_channel(vertices[i].color.y);
+		compact[i].color[2] = pack_color_channel(vertices[i].color.z);
+		compact[i].color[3] = 255;
+	}
+}
+void write_indices(VkSession *session, void *destination, uint32_t *indices, size_t count){
+	if(session->index_type == VK_INDEX_TYPE_UINT32){
+		memcpy(destination, indices, sizeof(uint32_t) * count);
+		return;
+	}
+	uint16_t *narrow = destination;
+	for(size_t i = 0; i < count; i++){
+		narrow[i] = (uint16_t)indices[i];
+	}
 }
 
 void create_sync_objects(VkSession *session){
-	session->image_available_semaphores = malloc(sizeof(VkSemaphore) * MAX_FRAMES_IN_FLIGHT);
-	session->render_finished_semaphores = malloc(sizeof(VkSemaphore) * MAX_FRAMES_IN_FLIGHT);
-	session->in_flight_fences = malloc(sizeof(VkFence) * MAX_FRAMES_IN_FLIGHT);
+	session->image_available_semaphores = malloc(sizeof(VkSemaphore) * session->frames_in_flight);
+	session->render_finished_semaphores = malloc(sizeof(VkSemaphore) * session->frames_in_flight);
+	session->in_flight_fences = malloc(sizeof(VkFence) * session->frames_in_flight);
+	session->frame_serials = calloc(session->frames_in_flight, sizeof(uint64_t));
+	assert(session->frame_serials != NULL);
+	session->submitted_frames = 0;
+	session->retired = NULL;
+	session->retired_count = 0;
+	session->retired_capacity = 0;
 	VkSemaphoreCreateInfo semaphore_info  = {0};
 	semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 	
@@ -829,7 +1434,7 @@ void create_sync_objects(VkSession *session){
 	fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 	fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-	for(int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++){
+	for(int i = 0; i < session->frames_in_flight; i++){
 		VkResult result = vkCreateSemaphore(session->logical_device, &semaphore_info, NULL, &session->image_available_semaphores[i]);
 		assert(result == VK_SUCCESS);
 		result = vkCreateSemaphore(session->logical_device, &semaphore_info, NULL, &session->render_finished_semaphores[i]);
@@ -840,6 +1445,119 @@ void create_sync_objects(VkSession *session){
 }
 
 
+double now_ms(){
+	struct timespec time;
+	timespec_get(&time, TIME_UTC);
+	return time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+}
+
+void create_frame_queries(VkSession *session){
+	session->timestamp_pool = VK_NULL_HANDLE;
+	session->statistics_pool = VK_NULL_HANDLE;
+	session->frame_number = 0;
+	session->frame_stats_next = 0;
+	session->frame_stats_count = 0;
+	session->frame_stats = malloc(sizeof(AuroraFrameStats) * FRAME_STATS_CAPACITY);
+	session->pending_stats = malloc(sizeof(AuroraFrameStats) * session->frames_in_flight);
+	session->queries_pending = calloc(session->frames_in_flight, sizeof(bool));
+	assert(session->frame_stats != NULL && session->pending_stats != NULL && session->queries_pending != NULL);
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(session->physical_device, &properties);
+	session->timestamp_period = properties.limits.timestampPeriod;
+	uint32_t count = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(session->physical_device, &count, NULL);
+	VkQueueFamilyProperties *families = malloc(sizeof(VkQueueFamilyProperties) * count);
+	assert(families != NULL);
+	vkGetPhysicalDeviceQueueFamilyProperties(session->physical_device, &count, families);
+	uint32_t valid_bits = families[session->graphics_queue_index].timestampValidBits;
+	free(families);
+	session->timestamp_mask = valid_bits >= 64 ? UINT64_MAX : ((uint64_t)1 << valid_bits) - 1;
+
+	// two timestamps per frame in flight, around the render pass
+	if(valid_bits != 0){
+		VkQueryPoolCreateInfo info = {0};
+		info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		info.queryCount = session->frames_in_flight * 2;
+		VkResult result = vkCreateQueryPool(session->logical_device, &info, NULL, &session->timestamp_pool);
+		assert(result == VK_SUCCESS);
+	}
+	if(session->pipeline_statistics){
+		VkQueryPoolCreateInfo info = {0};
+		info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+		info.queryCount = session->frames_in_flight;
+		info.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT
+			| VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT
+			| VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT
+			| VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT
+			| VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+		VkResult result = vkCreateQueryPool(session->logical_device, &info, NULL, &session->statistics_pool);
+		assert(result == VK_SUCCESS);
+	}
+}
+
+/**
+ * Completes the statistics of the frame that last used this frame slot and moves them into the ring.
+ * Must only be called once the slot's fence has been waited on, so the queries are available.
+ */
+void collect_frame_stats(VkSession *session, uint32_t frame){
+	if(!session->queries_pending[frame]){
+		return;
+	}
+	session->queries_pending[frame] = false;
+	AuroraFrameStats *stats = &session->pending_stats[frame];
+	if(session->timestamp_pool != VK_NULL_HANDLE){
+		uint64_t timestamps[2];
+		VkResult result = vkGetQueryPoolResults(session->logical_device, session->timestamp_pool, frame * 2, 2, sizeof(timestamps), timestamps,
+			sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+		if(result == VK_SUCCESS){
+			uint64_t ticks = (timestamps[1] - timestamps[0]) & session->timestamp_mask;
+			stats->gpu_ms = ticks * (double)session->timestamp_period / 1000000.0;
+			stats->has_gpu_time = true;
+		}
+	}
+	if(session->statistics_pool != VK_NULL_HANDLE){
+		// results come in the order of the statistic bits
+		uint64_t values[5];
+		VkResult result = vkGetQueryPoolResults(session->logical_device, session->statistics_pool, frame, 1, sizeof(values), values,
+			sizeof(values), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+		if(result == VK_SUCCESS){
+			stats->input_assembly_vertices = values[0];
+			stats->input_assembly_primitives = values[1];
+			stats->vertex_shader_invocations = values[2];
+			stats->clipping_primitives = values[3];
+			stats->fragment_shader_invocations = values[4];
+			stats->has_pipeline_statistics = true;
+		}
+	}
+	session->frame_stats[session->frame_stats_next] = *stats;
+	session->frame_stats_next = (session->frame_stats_next + 1) % FRAME_STATS_CAPACITY;
+	if(session->frame_stats_count < FRAME_STATS_CAPACITY){
+		session->frame_stats_count++;
+	}
+}
+
+AuroraFrameStats *begin_frame_stats(VkSession *session){
+	AuroraFrameStats *stats = &session->pending_stats[current_frame];
+	*stats = (AuroraFrameStats){0};
+	stats->frame = session->frame_number++;
+	return stats;
+}
+
+/**
+ * Copies up to max_count of the most recent frames, oldest first, and returns how many were copied.
+ */
+size_t vulkan_session_get_frame_stats(VkSession *session, AuroraFrameStats *stats, size_t max_count){
+	size_t count = session->frame_stats_count < max_count ? session->frame_stats_count : max_count;
+	size_t start = (session->frame_stats_next + FRAME_STATS_CAPACITY - count) % FRAME_STATS_CAPACITY;
+	for(size_t i = 0; i < count; i++){
+		stats[i] = session->frame_stats[(start + i) % FRAME_STATS_CAPACITY];
+	}
+	return count;
+}
+
 void recreate_swapchain(VkSession *session){
 	int width = 0;
 	int height = 0;
@@ -848,59 +1566,120 @@ void recreate_swapchain(VkSession *session){
 		glfwGetFramebufferSize(session->window, &width, &height);
 		glfwWaitEvents();
 	}
-	vkDeviceWaitIdle(session->logical_device);
-	
-	if(session->frame_buffers != NULL){
-		for(size_t i = 0; i < session->image_count; i++){
-			vkDestroyFramebuffer(session->logical_device, session->frame_buffers[i], NULL);
-		}
-		free(session->frame_buffers);
-	}	
-	if(session->image_views != NULL){
-		for(uint32_t i = 0; i < session->image_count; i++){
-			vkDestroyImageView(session->logical_device, session->image_views[i], NULL);
-		}
-		free(session->image_views);
-	}	
-	if(session->swapchain != NULL){
-		vkDestroySwapchainKHR(session->logical_device, session->swapchain, NULL);
+	// only used when the surface leaves the extent to the application
+	session->image_extent.width = (uint32_t)width;
+	session->image_extent.height = (uint32_t)height;
+
+	// frames still in flight use the old handles, so nothing is destroyed before their fences signalled
+	for(uint32_t i = 0; i < session->image_count; i++){
+		VkFramebuffer frame_buffer = session->frame_buffers != NULL ? session->frame_buffers[i] : VK_NULL_HANDLE;
+		retire_resource(session, (RetiredResource){ .framebuffer = frame_buffer, .image_view = session->image_views[i] });
+	}
+	// the image count may change, so the recorded buffers are reallocated rather than just invalidated
+	for(uint32_t i = 0; i < get_command_buffer_count(session); i++){
+		retire_resource(session, (RetiredResource){ .command_buffer = session->command_buffers[i] });
 	}
+	free(session->frame_buffers);
+	free(session->image_views);
+	free(session->command_buffers);
+	free(session->command_buffers_valid);
+	free(session->images);
+	free(session->image_damage);
 
-	create_swapchain(session);
+	// handing the old swapchain over lets the presentation engine finish its images while the new one is created
+	VkSwapchainKHR old_swapchain = session->swapchain;
+	create_swapchain(session, old_swapchain);
+	retire_resource(session, (RetiredResource){ .swapchain = old_swapchain });
 	create_image_views(session);
+	create_damage_regions(session);
 	create_framebuffers(session);	
+	allocate_command_buffers(session);
 }
 
 
-void vulkan_session_draw_frame(VkSession *session, bool resized){
+void draw_offscreen_frame(VkSession *session){
+	double start = now_ms();
 	vkWaitForFences(session->logical_device, 1, &session->in_flight_fences[current_frame], VK_TRUE, UINT64_MAX);
+	collect_frame_stats(session, current_frame);
+	destroy_retired_resources(session, session->frame_serials[current_frame]);
+	AuroraFrameStats *stats = begin_frame_stats(session);
+	double waited = now_ms();
+	stats->fence_wait_ms = waited - start;
+	vkResetFences(session->logical_device, 1, &session->in_flight_fences[current_frame]);
+	VkCommandBuffer command_buffer = get_command_buffer(session, current_frame);
+	double recorded = now_ms();
+	stats->record_ms = recorded - waited;
+
+	VkSubmitInfo submit_info = {0};
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+	if(session->upload_pending){
+		submit_info.waitSemaphoreCount = 1;
+		submit_info.pWaitSemaphores = &session->upload_semaphore;
+		submit_info.pWaitDstStageMask = &wait_stage;
+		session->upload_pending = false;
+	}
+	submit_info.commandBufferCount = 1;
+	submit_info.pCommandBuffers = &command_buffer;
+	VkResult result = vkQueueSubmit(session->graphics_queue, 1, &submit_info, session->in_flight_fences[current_frame]);
+	assert(result == VK_SUCCESS);
+	session->frame_serials[current_frame] = ++session->submitted_frames;
+	stats->submit_present_ms = now_ms() - recorded;
+	session->queries_pending[current_frame] = true;
+	current_frame = (current_frame + 1) % session->frames_in_flight;
+}
+
+/**
+ * Returns false when the frame was not presented because the swapchain was out of date and had to be recreated,
+ * so the caller knows the window still has to be drawn. A suboptimal or resized swapchain is recreated as well,
+ * but the image was queued, so that still counts as presented.
+ */
+bool vulkan_session_draw_frame(VkSession *session, bool resized){
+	if(session->headless){
+		draw_offscreen_frame(session);
+		return true;
+	}
+	double start = now_ms();
+	vkWaitForFences(session->logical_device, 1, &session->in_flight_fences[current_frame], VK_TRUE, UINT64_MAX);
+	collect_frame_stats(session, current_frame);
+	destroy_retired_resources(session, session->frame_serials[current_frame]);
+	double waited = now_ms();
 	uint32_t image_index;
 	VkResult res = vkAcquireNextImageKHR(session->logical_device, session->swapchain, UINT64_MAX, session->image_available_semaphores[current_frame], VK_NULL_HANDLE, &image_index);	
 	if(res == VK_ERROR_OUT_OF_DATE_KHR){
 		recreate_swapchain(session);
-		return;
+		return false;
 	}
 	assert(res == VK_SUCCESS || res == VK_SUBOPTIMAL_KHR);
+	AuroraFrameStats *stats = begin_frame_stats(session);
+	double acquired = now_ms();
+	stats->fence_wait_ms = waited - start;
+	stats->acquire_ms = acquired - waited;
 	vkResetFences(session->logical_device, 1, &session->in_flight_fences[current_frame]);
-	vkResetCommandBuffer(session->command_buffers[current_frame], 0);
-	record_command_buffer(session, image_index);
+	VkCommandBuffer command_buffer = get_command_buffer(session, image_index);
+	double recorded = now_ms();
+	stats->record_ms = recorded - acquired;
 	
 	VkSubmitInfo submit_info = {0};
 	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 	
-	VkSemaphore wait_semaphores[] = {session->image_available_semaphores[current_frame]};
-	VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-	submit_info.waitSemaphoreCount = 1;
+	// the vertex input of this frame also waits for geometry that was uploaded since the last one
+	VkSemaphore wait_semaphores[] = {session->image_available_semaphores[current_frame], session->upload_semaphore};
+	VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT};
+	submit_info.waitSemaphoreCount = session->upload_pending ? 2 : 1;
+	session->upload_pending = false;
 	submit_info.pWaitSemaphores = &wait_semaphores[0];
 	submit_info.pWaitDstStageMask = &wait_stages[0];
 	submit_info.commandBufferCount = 1;
-	submit_info.pCommandBuffers = &session->command_buffers[current_frame];
+	submit_info.pCommandBuffers = &command_buffer;
 	
 	VkSemaphore signal_semaphores[] = {session->render_finished_semaphores[current_frame]};
 	submit_info.signalSemaphoreCount = 1;
 	submit_info.pSignalSemaphores = &signal_semaphores[0];
 	VkResult result = vkQueueSubmit(session->graphics_queue, 1, &submit_info,session->in_flight_fences[current_frame]);
 	assert(result == VK_SUCCESS);	
+	session->frame_serials[current_frame] = ++session->submitted_frames;
+	session->queries_pending[current_frame] = true;
 	
 	VkPresentInfoKHR present_info = {0};
 	present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -912,7 +1691,31 @@ void vulkan_session_draw_frame(VkSession *session, bool resized){
 	present_info.pSwapchains = &swapchains[0];	
 	present_info.pImageIndices = &image_index;
 	present_info.pResults = NULL;
+	VkRectLayerKHR present_rects[MAX_DAMAGE_RECTS];
+	VkPresentRegionKHR present_region = {0};
+	VkPresentRegionsKHR present_regions = {0};
+	if(session->incremental_present && !session->present_damage.full){
+		for(uint32_t i = 0; i < session->present_damage.count; i++){
+			present_rects[i].offset = session->present_damage.rects[i].offset;
+			present_rects[i].extent = session->present_damage.rects[i].extent;
+			present_rects[i].layer = 0;
+		}
+		// a rectangle count of zero means the whole image changed, so nothing changed is a single empty rectangle
+		uint32_t rect_count = session->present_damage.count;
+		if(rect_count == 0){
+			present_rects[0] = (VkRectLayerKHR){ .offset = {0, 0}, .extent = {0, 0}, .layer = 0 };
+			rect_count = 1;
+		}
+		present_region.rectangleCount = rect_count;
+		present_region.pRectangles = present_rects;
+		present_regions.sType = VK_STRUCTURE_TYPE_PRESENT_REGIONS_KHR;
+		present_regions.swapchainCount = 1;
+		present_regions.pRegions = &present_region;
+		present_info.pNext = &present_regions;
+	}
+	session->present_damage = (DamageRegion){0};
 	res = vkQueuePresentKHR(session->present_queue, &present_info);
+	bool presented = res != VK_ERROR_OUT_OF_DATE_KHR;
 	if(res == VK_ERROR_OUT_OF_DATE_KHR || res == VK_SUBOPTIMAL_KHR || resized){
 		resized = false;
 		recreate_swapchain(session);	
@@ -920,7 +1723,9 @@ void vulkan_session_draw_frame(VkSession *session, bool resized){
 		printf("Error\n");
 		exit(1);
 	}
-	current_frame = (current_frame + 1) % MAX_FRAMES_IN_FLIGHT;
+	stats->submit_present_ms = now_ms() - recorded;
+	current_frame = (current_frame + 1) % session->frames_in_flight;
+	return presented;
 }
 
 void init_vertices(VkConfig *config, VkSession *session){
@@ -928,54 +1733,369 @@ void init_vertices(VkConfig *config, VkSession *session){
 	session->vertex_count = config->vertex_count;
 	session->indices = config->indices;
 	session->index_count = config->index_count;
+	session->index_type_fixed = config->index_width != AURORA_INDEX_WIDTH_AUTO;
+	session->index_type = VK_INDEX_TYPE_UINT16;
+	if(config->index_width == AURORA_INDEX_WIDTH_32 || (config->index_width == AURORA_INDEX_WIDTH_AUTO && config->vertex_count > UINT16_MAX + 1)){
+		session->index_type = VK_INDEX_TYPE_UINT32;
+	}
+	if(session->index_type == VK_INDEX_TYPE_UINT16 && config->vertex_count > UINT16_MAX + 1){
+		printf("Too many vertices for 16 bit indices.\n");
+		abort();
+	}
+	session->instanced = config->instanced;
+	session->instances = config->instances;
+	session->instance_count = config->instance_count;
+	session->headless = config->headless;
+	session->vertex_shader = config->vertex_shader;
+	session->frames_in_flight = config->frames_in_flight;
+	if(session->frames_in_flight < 1){
+		session->frames_in_flight = 1;
+	}
+	if(session->frames_in_flight > MAX_FRAMES_IN_FLIGHT){
+		session->frames_in_flight = MAX_FRAMES_IN_FLIGHT;
+	}
+	session->requested_image_count = config->swapchain_image_count > 0 ? (uint32_t)config->swapchain_image_count : 0;
+	session->preferred_present_mode = config->present_mode;
+	session->damage_rendering = config->damage_rendering;
+	session->compact_vertices = config->compact_vertices && !config->instanced;
+	session->view = get_view_transform(0.0f, 0.0f, (float)config->width, (float)config->height);
+	session->fragment_shader = config->fragment_shader;
 }
 
-void recreate_vertices(VkSession *session, Vertex *vertices, int vertex_count, uint16_t *indices, int index_count){
-	vkDeviceWaitIdle(session->logical_device);
-	session->vertices = malloc(sizeof(Vertex) * vertex_count);
-	for(int i = 0; i < vertex_count; i++){
-		session->vertices[i] = vertices[i];
+void create_upload_resources(VkSession *session){
+	session->copy_capacity = 16;
+	session->copies = malloc(sizeof(VkBufferCopy) * session->copy_capacity);
+	assert(session->copies != NULL);
+	session->upload_pending = false;
+
+	VkCommandPoolCreateInfo pool_info = {0};
+	pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+	pool_info.queueFamilyIndex = session->transfer_queue_index;
+	VkResult result = vkCreateCommandPool(session->logical_device, &pool_info, NULL, &session->transfer_command_pool);
+	assert(result == VK_SUCCESS);
+
+	VkCommandBufferAllocateInfo info = {0};
+	info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	info.commandPool = session->transfer_command_pool;
+	info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	info.commandBufferCount = 1;
+	VkFenceCreateInfo fence_info = {0};
+	fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+	for(uint32_t i = 0; i < UPLOAD_SLOTS; i++){
+		UploadSlot *upload = &session->uploads[i];
+		*upload = (UploadSlot){0};
+		result = vkAllocateCommandBuffers(session->logical_device, &info, &upload->command_buffer);
+		assert(result == VK_SUCCESS);
+		result = vkCreateFence(session->logical_device, &fence_info, NULL, &upload->fence);
+		assert(result == VK_SUCCESS);
 	}
-	session->vertex_count = vertex_count;
+	session->upload_index = 0;
+	session->upload_command_buffer = VK_NULL_HANDLE;
+	session->staging_buffer = VK_NULL_HANDLE;
+	session->staging_data = NULL;
+	VkSemaphoreCreateInfo semaphore_info = {0};
+	semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	result = vkCreateSemaphore(session->logical_device, &semaphore_info, NULL, &session->upload_semaphore);
+	assert(result == VK_SUCCESS);
+	result = vkCreateSemaphore(session->logical_device, &semaphore_info, NULL, &session->graphics_release_semaphore);
+	assert(result == VK_SUCCESS);
+
+	session->vertex_buffer = VK_NULL_HANDLE;
+	session->vertex_buffer_memory = (MemoryAllocation){0};
+	session->vertex_capacity = 0;
+	session->index_buffer = VK_NULL_HANDLE;
+	session->index_buffer_memory = (MemoryAllocation){0};
+	session->index_capacity = 0;
+}
 
-	session->indices = malloc(sizeof(uint16_t) * index_count);
-	for(int i = 0; i < index_count; i++){
-		session->indices[i] = indices[i];
+/**
+ * Opens the next upload slot on the transfer queue. It only waits for the upload that last used the slot,
+ * so back to back uploads (an index widening followed by a patch, say) do not wait for each other's copies.
+ * Each slot's staging buffer stays mapped and doubles when it is too small.
+ */
+void begin_upload(VkSession *session, VkDeviceSize staging_size){
+	session->upload_index = (session->upload_index + 1) % UPLOAD_SLOTS;
+	UploadSlot *upload = &session->uploads[session->upload_index];
+	vkWaitForFences(session->logical_device, 1, &upload->fence, VK_TRUE, UINT64_MAX);
+	if(staging_size > upload->staging_capacity){
+		VkDeviceSize capacity = upload->staging_capacity * 2 > staging_size ? upload->staging_capacity * 2 : staging_size;
+		if(upload->staging_buffer != VK_NULL_HANDLE){
+			destroy_buffer(session, upload->staging_buffer, &upload->staging_buffer_memory);
+		}
+		create_buffer(session, capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &upload->staging_buffer, &upload->staging_buffer_memory);
+		upload->staging_data = upload->staging_buffer_memory.mapped;
+		upload->staging_capacity = capacity;
 	}
-	session->index_count = index_count;
-	
+	session->upload_command_buffer = upload->command_buffer;
+	session->staging_buffer = upload->staging_buffer;
+	session->staging_data = upload->staging_data;
+
+	vkResetCommandBuffer(session->upload_command_buffer, 0);
+	VkCommandBufferBeginInfo begin_info = {0};
+	begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	VkResult result = vkBeginCommandBuffer(session->upload_command_buffer, &begin_info);
+	assert(result == VK_SUCCESS);
+}
+
+/**
+ * Submits the upload without waiting for it. Frames already submitted may still read the buffers being
+ * overwritten (or retired), so an empty graphics submit first signals once they are done and the copies wait on that.
+ * Every frame reads all of the geometry from the one vertex and index buffer, so that is the last submitted frame;
+ * the copies only overlap with frames recorded after them.
+ * The next frame waits on upload_semaphore; if no frame ran since the previous upload, this one waits on it instead.
+ */
+void end_upload(VkSession *session){
+	VkResult result = vkEndCommandBuffer(session->upload_command_buffer);
+	assert(result == VK_SUCCESS);
 
-	vkDestroyBuffer(session->logical_device, session->vertex_buffer, NULL);
-	vkFreeMemory(session->logical_device, session->vertex_buffer_memory, NULL);
-	vkDestroyBuffer(session->logical_device, session->index_buffer, NULL);
-	vkFreeMemory(session->logical_device, session->index_buffer_memory, NULL);
+	VkSubmitInfo release_info = {0};
+	release_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	release_info.signalSemaphoreCount = 1;
+	release_info.pSignalSemaphores = &session->graphics_release_semaphore;
+	result = vkQueueSubmit(session->graphics_queue, 1, &release_info, VK_NULL_HANDLE);
+	assert(result == VK_SUCCESS);
 
-	create_vertex_buffer(session);
-	create_index_buffer(session);
+	VkSemaphore wait_semaphores[] = {session->graphics_release_semaphore, session->upload_semaphore};
+	VkPipelineStageFlags wait_stages[] = {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT};
+	VkSubmitInfo submit_info = {0};
+	submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submit_info.waitSemaphoreCount = session->upload_pending ? 2 : 1;
+	submit_info.pWaitSemaphores = wait_semaphores;
+	submit_info.pWaitDstStageMask = wait_stages;
+	submit_info.commandBufferCount = 1;
+	submit_info.pCommandBuffers = &session->upload_command_buffer;
+	submit_info.signalSemaphoreCount = 1;
+	submit_info.pSignalSemaphores = &session->upload_semaphore;
+	VkFence fence = session->uploads[session->upload_index].fence;
+	vkResetFences(session->logical_device, 1, &fence);
+	result = vkQueueSubmit(session->transfer_queue, 1, &submit_info, fence);
+	assert(result == VK_SUCCESS);
+	session->upload_pending = true;
 }
 
+/**
+ * Makes sure the device local buffer can hold size bytes, at least doubling its capacity when it grows.
+ * The first used bytes are carried over with a copy on the device, the old buffer is retired until the frames reading it are done.
+ */
+void reserve_buffer(VkSession *session, VkBuffer *buffer, MemoryAllocation *memory, VkDeviceSize *capacity, VkDeviceSize used, VkDeviceSize size, VkBufferUsageFlags usage){
+	if(size <= *capacity){
+		return;
+	}
+	VkDeviceSize new_capacity = *capacity * 2 > size ? *capacity * 2 : size;
+	VkBuffer new_buffer;
+	MemoryAllocation new_memory;
+	create_buffer(session, new_capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &new_buffer, &new_memory);
+	if(used > 0){
+		VkBufferCopy copy = {0};
+		copy.size = used;
+		vkCmdCopyBuffer(session->upload_command_buffer, *buffer, new_buffer, 1, &copy);
+		VkMemoryBarrier barrier = {0};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		vkCmdPipelineBarrier(session->upload_command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, NULL, 0, NULL);
+	}
+	if(*buffer != VK_NULL_HANDLE){
+		retire_resource(session, (RetiredResource){ .buffer = *buffer, .memory = *memory });
+	}
+	*buffer = new_buffer;
+	*memory = new_memory;
+	*capacity = new_capacity;
+	invalidate_command_buffers(session);
+}
 
-void add_vertices(VkSession *session, Vertex *vertices, int vertex_count, uint16_t *indices, int index_count){
-	vkDeviceWaitIdle(session->logical_device);
-	session->vertices = realloc(session->vertices, sizeof(Vertex) * (session->vertex_count + vertex_count));	
-	for(int i = 0; i < vertex_count; i++){
-		session->vertices[session->vertex_count + i] = vertices[i];
+/**
+ * Switches an automatic session to 32 bit indices once the vertices no longer fit 16 bit ones,
+ * a session with a fixed 16 bit width aborts instead of letting the indices wrap.
+ */
+void ensure_index_width(VkSession *session, size_t vertex_count, size_t leaf_count){
+	if(session->index_type == VK_INDEX_TYPE_UINT32 || vertex_count <= UINT16_MAX + 1){
+		return;
 	}
-	session->vertex_count += vertex_count;
-	session->indices = realloc(session->indices, sizeof(uint16_t) * (session->index_count + index_count));
-	for(int i = 0; i < index_count; i++){
-		session->indices[session->index_count + i] = indices[i];
+	if(session->index_type_fixed){
+		printf("Too many vertices for 16 bit indices.\n");
+		abort();
+	}
+	session->index_type = VK_INDEX_TYPE_UINT32;
+	invalidate_command_buffers(session);
+	if(leaf_count == 0){
+		return;
+	}
+	// every slot owns the same indices, so the existing ones are regenerated at the new width
+	VkDeviceSize index_size = sizeof(uint32_t) * INDICES_PER_LEAF * leaf_count;
+	begin_upload(session, index_size);
+	uint32_t *indices = session->staging_data;
+	for(size_t slot = 0; slot < leaf_count; slot++){
+		get_leaf_indices((uint32_t)slot, &indices[slot * INDICES_PER_LEAF]);
+	}
+	reserve_buffer(session, &session->index_buffer, &session->index_buffer_memory, &session->index_capacity, 0, index_size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+	VkBufferCopy copy = { .srcOffset = 0, .dstOffset = 0, .size = index_size };
+	vkCmdCopyBuffer(session->upload_command_buffer, session->staging_buffer, session->index_buffer, 1, &copy);
+	end_upload(session);
+}
+
+void recreate_vertices(VkSession *session, Vertex *vertices, int vertex_count, uint32_t *indices, int index_count){
+	ensure_index_width(session, vertex_count, 0);
+	VkDeviceSize vertex_size = get_vertex_size(session) * vertex_count;
+	VkDeviceSize index_size = get_index_size(session) * index_count;
+	begin_upload(session, vertex_size + index_size);
+	write_vertices(session, session->staging_data, vertices, vertex_count);
+	write_indices(session, (char*)session->staging_data + vertex_size, indices, index_count);
+	reserve_buffer(session, &session->vertex_buffer, &session->vertex_buffer_memory, &session->vertex_capacity, 0, vertex_size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+	reserve_buffer(session, &session->index_buffer, &session->index_buffer_memory, &session->index_capacity, 0, index_size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+	if(vertex_size > 0){
+		VkBufferCopy copy = { .srcOffset = 0, .dstOffset = 0, .size = vertex_size };
+		vkCmdCopyBuffer(session->upload_command_buffer, session->staging_buffer, session->vertex_buffer, 1, &copy);
 	}
+	if(index_size > 0){
+		VkBufferCopy copy = { .srcOffset = vertex_size, .dstOffset = 0, .size = index_size };
+		vkCmdCopyBuffer(session->upload_command_buffer, session->staging_buffer, session->index_buffer, 1, &copy);
+	}
+	end_upload(session);
+	session->vertex_count = vertex_count;
+	session->index_count = index_count;
+	invalidate_command_buffers(session);
+	vulkan_session_damage_all(session);
+}
+
+
+void add_vertices(VkSession *session, Vertex *vertices, int vertex_count, uint32_t *indices, int index_count){
+	ensure_index_width(session, session->vertex_count + vertex_count, session->index_count / INDICES_PER_LEAF);
+	VkDeviceSize vertex_offset = get_vertex_size(session) * session->vertex_count;
+	VkDeviceSize vertex_size = get_vertex_size(session) * vertex_count;
+	VkDeviceSize index_offset = get_index_size(session) * session->index_count;
+	VkDeviceSize index_size = get_index_size(session) * index_count;
+	begin_upload(session, vertex_size + index_size);
+	write_vertices(session, session->staging_data, vertices, vertex_count);
+	write_indices(session, (char*)session->staging_data + vertex_size, indices, index_count);
+	reserve_buffer(session, &session->vertex_buffer, &session->vertex_buffer_memory, &session->vertex_capacity, vertex_offset, vertex_offset + vertex_size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+	reserve_buffer(session, &session->index_buffer, &session->index_buffer_memory, &session->index_capacity, index_offset, index_offset + index_size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+	if(vertex_size > 0){
+		VkBufferCopy copy = { .srcOffset = 0, .dstOffset = vertex_offset, .size = vertex_size };
+		vkCmdCopyBuffer(session->upload_command_buffer, session->staging_buffer, session->vertex_buffer, 1, &copy);
+	}
+	if(index_size > 0){
+		VkBufferCopy copy = { .srcOffset = vertex_size, .dstOffset = index_offset, .size = index_size };
+		vkCmdCopyBuffer(session->upload_command_buffer, session->staging_buffer, session->index_buffer, 1, &copy);
+	}
+	end_upload(session);
+	session->vertex_count += vertex_count;
 	session->index_count += index_count;
-	
+	invalidate_command_buffers(session);
+	vulkan_session_damage_all(session);
+}
 
-	vkDestroyBuffer(session->logical_device, session->vertex_buffer, NULL);
-	vkFreeMemory(session->logical_device, session->vertex_buffer_memory, NULL);
-	vkDestroyBuffer(session->logical_device, session->index_buffer, NULL);
-	vkFreeMemory(session->logical_device, session->index_buffer_memory, NULL);
+/**
+ * Uploads only the leaves in patches, each to the range its slot owns. Patches of consecutive slots are merged into one copy.
+ */
+void patch_vertices(VkSession *session, LeafPatch *patches, size_t patch_count, size_t leaf_count){
+	ensure_index_width(session, leaf_count * VERTICES_PER_LEAF, session->index_count / INDICES_PER_LEAF);
+	VkDeviceSize vertex_stride = get_vertex_size(session) * VERTICES_PER_LEAF;
+	VkDeviceSize index_stride = get_index_size(session) * INDICES_PER_LEAF;
+	if(patch_count > 0){
+		if(patch_count * 2 > session->copy_capacity){
+			session->copy_capacity = patch_count * 2;
+			session->copies = realloc(session->copies, sizeof(VkBufferCopy) * session->copy_capacity);
+			assert(session->copies != NULL);
+		}
+		VkDeviceSize index_start = vertex_stride * patch_count;
+		begin_upload(session, (vertex_stride + index_stride) * patch_count);
+		reserve_buffer(session, &session->vertex_buffer, &session->vertex_buffer_memory, &session->vertex_capacity, 
+			get_vertex_size(session) * session->vertex_count, vertex_stride * leaf_count, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+		reserve_buffer(session, &session->index_buffer, &session->index_buffer_memory, &session->index_capacity, 
+			get_index_size(session) * session->index_count, index_stride * leaf_count, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+
+		char *staging = session->staging_data;
+		VkBufferCopy *vertex_copies = session->copies;
+		VkBufferCopy *index_copies = session->copies + patch_count;
+		uint32_t copy_count = 0;
+		for(size_t i = 0; i < patch_count; i++){
+			write_vertices(session, staging + vertex_stride * i, patches[i].vertices, VERTICES_PER_LEAF);
+			write_indices(session, staging + index_start + index_stride * i, patches[i].indices, INDICES_PER_LEAF);
+			if(i > 0 && patches[i].slot == patches[i - 1].slot + 1){
+				vertex_copies[copy_count - 1].size += vertex_stride;
+				index_copies[copy_count - 1].size += index_stride;
+				continue;
+			}
+			vertex_copies[copy_count] = (VkBufferCopy){
+				.srcOffset = vertex_stride * i,
+				.dstOffset = vertex_stride * patches[i].slot,
+				.size = vertex_stride
+			};
+			index_copies[copy_count] = (VkBufferCopy){
+				.srcOffset = index_start + index_stride * i,
+				.dstOffset = index_stride * patches[i].slot,
+				.size = index_stride
+			};
+			copy_count++;
+		}
+		vkCmdCopyBuffer(session->upload_command_buffer, session->staging_buffer, session->vertex_buffer, copy_count, vertex_copies);
+		vkCmdCopyBuffer(session->upload_command_buffer, session->staging_buffer, session->index_buffer, copy_count, index_copies);
+		end_upload(session);
+		damage_patches(session, patches, patch_count);
+	}
+	if(session->index_count != (int)(leaf_count * INDICES_PER_LEAF)){
+		invalidate_command_buffers(session);
+	}
+	session->vertex_count = (int)(leaf_count * VERTICES_PER_LEAF);
+	session->index_count = (int)(leaf_count * INDICES_PER_LEAF);
+}
 
-	create_vertex_buffer(session);
-	create_index_buffer(session); // todo
+/**
+ * Instanced counterpart of patch_vertices, every patch replaces the single instance at its slot.
+ */
+void patch_instances(VkSession *session, LeafPatch *patches, size_t patch_count, size_t leaf_count){
+	VkDeviceSize stride = sizeof(RectInstance);
+	if(patch_count > 0){
+		if(patch_count > session->copy_capacity){
+			session->copy_capacity = patch_count;
+			session->copies = realloc(session->copies, sizeof(VkBufferCopy) * session->copy_capacity);
+			assert(session->copies != NULL);
+		}
+		begin_upload(session, stride * patch_count);
+		reserve_buffer(session, &session->vertex_buffer, &session->vertex_buffer_memory, &session->vertex_capacity, 
+			stride * session->instance_count, stride * leaf_count, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+
+		RectInstance *staging = session->staging_data;
+		uint32_t copy_count = 0;
+		for(size_t i = 0; i < patch_count; i++){
+			staging[i] = patches[i].instance;
+			if(i > 0 && patches[i].slot == patches[i - 1].slot + 1){
+				session->copies[copy_count - 1].size += stride;
+				continue;
+			}
+			session->copies[copy_count++] = (VkBufferCopy){
+				.srcOffset = stride * i,
+				.dstOffset = stride * patches[i].slot,
+				.size = stride
+			};
+		}
+		vkCmdCopyBuffer(session->upload_command_buffer, session->staging_buffer, session->vertex_buffer, copy_count, session->copies);
+		end_upload(session);
+		damage_patches(session, patches, patch_count);
+	}
+	if(session->instance_count != (int)leaf_count){
+		invalidate_command_buffers(session);
+	}
+	session->instance_count = (int)leaf_count;
+}
+
+void recreate_instances(VkSession *session, RectInstance *instances, int instance_count){
+	VkDeviceSize size = sizeof(RectInstance) * instance_count;
+	begin_upload(session, size);
+	memcpy(session->staging_data, instances, (size_t) size);
+	reserve_buffer(session, &session->vertex_buffer, &session->vertex_buffer_memory, &session->vertex_capacity, 0, size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+	if(size > 0){
+		VkBufferCopy copy = { .srcOffset = 0, .dstOffset = 0, .size = size };
+		vkCmdCopyBuffer(session->upload_command_buffer, session->staging_buffer, session->vertex_buffer, 1, &copy);
+	}
+	end_upload(session);
+	session->instance_count = instance_count;
+	invalidate_command_buffers(session);
+	vulkan_session_damage_all(session);
 }
 
 VkSession *vulkan_session_create(VkConfig *config){
@@ -985,20 +2105,40 @@ VkSession *vulkan_session_create(VkConfig *config){
 	VkSession *session = malloc(sizeof(VkSession));
 	init_vertices(config, session);
 	create_vk_instance(config, session);
-	create_window(session);
-	create_surface(session);
+	if(session->headless){
+		session->window = NULL;
+		session->surface = VK_NULL_HANDLE;
+	}else{
+		create_window(config, session);
+		create_surface(session);
+	}
 	select_physical_device(session);
+	check_compact_vertex_support(config, session);
 	create_logical_device(config, session);
-	create_swapchain(session);
+	session->allocator = create_memory_allocator(session->physical_device, session->logical_device);
+	if(session->headless){
+		create_offscreen_images(config, session);
+	}else{
+		session->image_memory = NULL;
+		create_swapchain(session, VK_NULL_HANDLE);
+	}
 	create_image_views(session);
+	create_damage_regions(session);
 	create_render_pass(session);
+	create_pipeline_cache(config, session);
 	create_graphics_pipeline(session);
 	create_framebuffers(session);
 	create_command_pool(session);
-	create_vertex_buffer(session);
-	create_index_buffer(session);
 	allocate_command_buffers(session);
 	create_sync_objects(session);
+	create_upload_resources(session);
+	create_frame_queries(session);
+	// the first frame waits for this like for any other upload
+	if(session->instanced){
+		recreate_instances(session, session->instances, session->instance_count);
+	}else{
+		recreate_vertices(session, session->vertices, session->vertex_count, session->indices, session->index_count);
+	}
 	return session;
 }
 
@@ -1006,41 +2146,88 @@ GLFWwindow *vulkan_session_get_window(VkSession *session){
 	return session->window;
 }
 
+void vulkan_session_wait_idle(VkSession *session){
+	vkDeviceWaitIdle(session->logical_device);
+	destroy_retired_resources(session, UINT64_MAX);
+	// oldest frame first, so the ring stays in frame order
+	for(int i = 0; i < session->frames_in_flight; i++){
+		collect_frame_stats(session, (current_frame + i) % session->frames_in_flight);
+	}
+}
+
 void vulkan_session_destroy(VkSession *session){
 	vkDeviceWaitIdle(session->logical_device);
-		for(int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++){
+		for(int i = 0; i < session->frames_in_flight; i++){
 			vkDestroyFence(session->logical_device, session->in_flight_fences[i], NULL);
 		}
-		for(int i = 0; i <MAX_FRAMES_IN_FLIGHT; i++){
+		for(int i = 0; i <session->frames_in_flight; i++){
 			vkDestroySemaphore(session->logical_device, session->render_finished_semaphores[i], NULL);
 		}
-		for(int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++){
+		for(int i = 0; i < session->frames_in_flight; i++){
 			vkDestroySemaphore(session->logical_device, session->image_available_semaphores[i], NULL);
 		}
 
+	if(session->timestamp_pool != VK_NULL_HANDLE){
+		vkDestroyQueryPool(session->logical_device, session->timestamp_pool, NULL);
+	}
+	if(session->statistics_pool != VK_NULL_HANDLE){
+		vkDestroyQueryPool(session->logical_device, session->statistics_pool, NULL);
+	}
+	free(session->frame_stats);
+	free(session->pending_stats);
+	free(session->queries_pending);
+	vkDestroySemaphore(session->logical_device, session->upload_semaphore, NULL);
+	vkDestroySemaphore(session->logical_device, session->graphics_release_semaphore, NULL);
+	destroy_retired_resources(session, UINT64_MAX);
+	free(session->retired);
+	free(session->frame_serials);
+	for(uint32_t i = 0; i < UPLOAD_SLOTS; i++){
+		vkDestroyFence(session->logical_device, session->uploads[i].fence, NULL);
+		if(session->uploads[i].staging_buffer != VK_NULL_HANDLE){
+			destroy_buffer(session, session->uploads[i].staging_buffer, &session->uploads[i].staging_buffer_memory);
+		}
+	}
+	free(session->copies);
+	vkDestroyCommandPool(session->logical_device, session->transfer_command_pool, NULL);
+	free_command_buffers(session);
 	vkDestroyCommandPool(session->logical_device, session->command_pool, NULL);
 
-	for(uint32_t i = 0; i < session->image_count; i++){
+	for(uint32_t i = 0; session->frame_buffers != NULL && i < session->image_count; i++){
 		vkDestroyFramebuffer(session->logical_device, session->frame_buffers[i], NULL);
 	}
 	free(session->frame_buffers);
 	vkDestroyPipeline(session->logical_device, session->graphics_pipeline, NULL);
+	save_pipeline_cache(session);
+	vkDestroyPipelineCache(session->logical_device, session->pipeline_cache, NULL);
 	vkDestroyPipelineLayout(session->logical_device, session->pipeline_layout, NULL);
 	vkDestroyRenderPass(session->logical_device, session->render_pass, NULL);
+	vkDestroyRenderPass(session->logical_device, session->load_render_pass, NULL);
+	free(session->image_damage);
 	for(uint32_t i = 0; i < session->image_count; i++){
 		vkDestroyImageView(session->logical_device, session->image_views[i], NULL);
 	}
 	free(session->image_views);
+	if(session->headless){
+		for(uint32_t i = 0; i < session->image_count; i++){
+			vkDestroyImage(session->logical_device, session->images[i], NULL);
+			vkFreeMemory(session->logical_device, session->image_memory[i], NULL);
+		}
+		free(session->image_memory);
+	}else{
+		vkDestroySwapchainKHR(session->logical_device, session->swapchain, NULL);
+	}
 	free(session->images);
-	vkDestroySwapchainKHR(session->logical_device, session->swapchain, NULL);
-	vkDestroyBuffer(session->logical_device, session->vertex_buffer, NULL);
-	vkFreeMemory(session->logical_device, session->vertex_buffer_memory, NULL);
-	vkDestroyBuffer(session->logical_device, session->index_buffer, NULL);
-	vkFreeMemory(session->logical_device, session->index_buffer_memory, NULL);
+	destroy_buffer(session, session->vertex_buffer, &session->vertex_buffer_memory);
+	destroy_buffer(session, session->index_buffer, &session->index_buffer_memory);
+	destroy_memory_allocator(session->allocator);
 	vkDestroyDevice(session->logical_device, NULL);
-	vkDestroySurfaceKHR(session->instance, session->surface, NULL);
+	if(!session->headless){
+		vkDestroySurfaceKHR(session->instance, session->surface, NULL);
+	}
 	vkDestroyInstance(session->instance, NULL);
-	glfwDestroyWindow(session->window);
-	glfwTerminate();
+	if(!session->headless){
+		glfwDestroyWindow(session->window);
+		glfwTerminate();
+	}
 	free(session);
 }
@@ -5,7 +5,14 @@
 
 extern VkSession *vulkan_session_create(VkConfig* config);
 extern GLFWwindow *vulkan_session_get_window(VkSession *session);
-extern void vulkan_session_draw_frame(VkSession *session, bool resized);
+extern bool vulkan_session_draw_frame(VkSession *session, bool resized);
+extern void vulkan_session_damage_all(VkSession *session);
+extern void vulkan_session_set_view(VkSession *session, float x, float y, float width, float height);
+extern void vulkan_session_wait_idle(VkSession *session);
+extern size_t vulkan_session_get_frame_stats(VkSession *session, AuroraFrameStats *stats, size_t max_count);
 extern void vulkan_session_destroy(VkSession *session);
-extern void recreate_vertices(VkSession *session, Vertex *vertices, int vertex_count, uint16_t *indices, int index_count);
+extern void recreate_vertices(VkSession *session, Vertex *vertices, int vertex_count, uint32_t *indices, int index_count);
+extern void patch_vertices(VkSession *session, LeafPatch *patches, size_t patch_count, size_t leaf_count);
+extern void patch_instances(VkSession *session, LeafPatch *patches, size_t patch_count, size_t leaf_count);
+extern void recreate_instances(VkSession *session, RectInstance *instances, int instance_count);
 #endif
@@ -0,0 +1,96 @@
+/**
+ * Standalone benchmark of the tree hot paths, it needs no window or GPU:
+ *   cc -O2 -pthread -I. bench_tree.c aurora_tree.c aurora_quadtree.c aurora_vertex.c -o bench_tree
+ * Prints one csv row per layout size so runs can be diffed or plotted.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "aurora_tree.h"
+
+#define QUERY_COUNT 1000000
+#define DRAW_DATA_RUNS 5
+
+static uint64_t random_state = 0x9E3779B97F4A7C15ull;
+
+// xorshift, so every platform builds the same layouts
+static uint32_t next_random(uint32_t bound) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return (uint32_t)(random_state % bound);
+}
+
+static double now_ns(void) {
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+static size_t tree_bytes(Tree *tree) {
+    size_t bytes = sizeof(Tree);
+    bytes += sizeof(Node) * tree->node_capacity;
+    bytes += sizeof(uint32_t) * tree->slot_capacity;
+    bytes += (sizeof(uint32_t) + sizeof(LeafPatch)) * tree->dirty_capacity;
+    if (tree->index != NULL) {
+        bytes += sizeof(QuadTree) + sizeof(QuadCell) * tree->index->cell_capacity;
+        bytes += sizeof(QuadBucket) * tree->index->bucket_capacity + sizeof(QuadRect) * tree->index->rect_capacity;
+    }
+    return bytes;
+}
+
+static void run(size_t split_count) {
+    // every split cuts a column of at least one pixel, so the layout has to be wide enough
+    int width = (int)(split_count * 16);
+    int height = 600;
+    Tree *tree = create_tree(width, height);
+    enable_spatial_index(tree);
+
+    double start = now_ns();
+    size_t splits = 0;
+    while (splits < split_count) {
+        int x = (int)next_random((uint32_t)width);
+        int y = (int)next_random((uint32_t)height);
+        size_t before = get_leaf_count(tree);
+        split_node(tree, find_at(tree, x, y), x, y);
+        splits += get_leaf_count(tree) - before;
+    }
+    double split_ns = (now_ns() - start) / (double)split_count;
+
+    uintptr_t sink = 0;
+    start = now_ns();
+    for (int i = 0; i < QUERY_COUNT; i++) {
+        sink += (uintptr_t)find_at(tree, (int)next_random((uint32_t)width), (int)next_random((uint32_t)height));
+    }
+    double find_ns = (now_ns() - start) / QUERY_COUNT;
+
+    double draw_data_ns = 0;
+    for (int i = 0; i < DRAW_DATA_RUNS; i++) {
+        Vertex *vertices;
+        uint32_t *indices;
+        size_t vertex_count, index_count;
+        start = now_ns();
+        get_draw_data(tree, &vertices, &vertex_count, &indices, &index_count);
+        draw_data_ns += now_ns() - start;
+        sink += vertex_count + index_count;
+        free(vertices);
+        free(indices);
+    }
+    draw_data_ns /= DRAW_DATA_RUNS;
+
+    size_t bytes = tree_bytes(tree);
+    printf("%zu,%zu,%.1f,%.1f,%.0f,%.2f,%.1f,%zu\n", split_count, get_leaf_count(tree), split_ns, find_ns,
+        draw_data_ns, draw_data_ns / (double)get_leaf_count(tree), (double)bytes / (double)tree->node_used, (size_t)(sink & 1));
+    destroy_tree(tree);
+}
+
+int main(int argc, char **argv) {
+    size_t max_splits = argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : 1000000;
+    printf("splits,leaves,split_ns_per_op,find_at_ns_per_op,get_draw_data_ns,get_draw_data_ns_per_leaf,bytes_per_node,sink\n");
+    for (size_t split_count = 1000; split_count <= max_splits; split_count *= 10) {
+        run(split_count);
+    }
+    return 0;
+}
@@ -0,0 +1,67 @@
+/**
+ * Standalone benchmark of the leaf vertex kernels against the scalar one, it needs no window or GPU:
+ *   cc -O2 -I. bench_vertex.c aurora_vertex.c -o bench_vertex
+ * Prints one csv row per kernel the cpu supports, after checking its output matches the scalar kernel.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "aurora_vertex.h"
+
+#define RECT_COUNT 1000000
+#define RUNS 20
+
+static uint64_t random_state = 0x9E3779B97F4A7C15ull;
+
+static uint32_t next_random(uint32_t bound) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return (uint32_t)(random_state % bound);
+}
+
+static double now_ns(void) {
+    struct timespec time;
+    timespec_get(&time, TIME_UTC);
+    return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+    size_t rect_count = argc > 1 ? (size_t)strtoull(argv[1], NULL, 10) : RECT_COUNT;
+    LeafRect *rects = malloc(sizeof(LeafRect) * rect_count);
+    Vertex *expected = malloc(sizeof(Vertex) * rect_count * 4);
+    Vertex *vertices = malloc(sizeof(Vertex) * rect_count * 4);
+    if (rects == 0 || expected == 0 || vertices == 0) { abort(); }
+    for (size_t i = 0; i < rect_count; i++) {
+        rects[i] = (LeafRect){ (int)next_random(60000), (int)next_random(60000), (int)next_random(4000) + 1, (int)next_random(4000) + 1 };
+    }
+    get_leaf_kernel(LEAF_KERNEL_SCALAR)(rects, rect_count, expected);
+
+    const char *names[] = { "scalar", "sse2", "avx2" };
+    double scalar_ns = 0;
+    printf("kernel,rects,ns_per_rect,speedup\n");
+    for (int level = LEAF_KERNEL_SCALAR; level <= LEAF_KERNEL_AVX2; level++) {
+        LeafKernel kernel = get_leaf_kernel((LeafKernelLevel)level);
+        if (kernel == NULL) continue;
+        memset(vertices, 0, sizeof(Vertex) * rect_count * 4);
+        kernel(rects, rect_count, vertices);
+        if (memcmp(vertices, expected, sizeof(Vertex) * rect_count * 4) != 0) {
+            printf("The %s kernel does not match the scalar kernel.\n", names[level]);
+            return 1;
+        }
+        double start = now_ns();
+        for (int run = 0; run < RUNS; run++) {
+            kernel(rects, rect_count, vertices);
+        }
+        double ns = (now_ns() - start) / RUNS / (double)rect_count;
+        if (level == LEAF_KERNEL_SCALAR) scalar_ns = ns;
+        printf("%s,%zu,%.3f,%.2f\n", names[level], rect_count, ns, scalar_ns / ns);
+    }
+    free(rects);
+    free(expected);
+    free(vertices);
+    return 0;
+}
@@ -26,3 +26,39 @@ int write_file(char* file_name, void* array, size_t size, size_t amount){
 	fclose(file);
 	return 1;
 }
+
+/**
+ * Reads a whole file that is allowed to be missing, returns NULL if it cannot be opened or read.
+ */
+char* try_read_file(char* file_name, size_t* length){
+	FILE *file = fopen(file_name, "rb");
+	if(file == NULL){
+		return NULL;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if(size <= 0){
+		fclose(file);
+		return NULL;
+	}
+	char* buffer = malloc((size_t)size);
+	if(buffer == NULL || fread(buffer, 1, (size_t)size, file) != (size_t)size){
+		free(buffer);
+		fclose(file);
+		return NULL;
+	}
+	fclose(file);
+	*length = (size_t)size;
+	return buffer;
+}
+
+bool try_write_file(char* file_name, void* data, size_t length){
+	FILE *file = fopen(file_name, "wb");
+	if(file == NULL){
+		return false;
+	}
+	size_t saved = fwrite(data, 1, length, file);
+	fclose(file);
+	return saved == length;
+}
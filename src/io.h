@@ -4,10 +4,13 @@
 #include <stdio.h>
 #include "assert.h"
 #include <stdlib.h>
+#include <stdbool.h>
 
 
 extern size_t fetch_file_size(char* file_name);
 extern char* read_file(char* file_name, size_t amount);
 extern int write_file(char* file_name, void* data, size_t size, size_t amount);
+extern char* try_read_file(char* file_name, size_t* length);
+extern bool try_write_file(char* file_name, void* data, size_t length);
 
 #endif
\ No newline at end of file
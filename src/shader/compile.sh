@@ -1,2 +1,13 @@
+# Builds the SPIR-V modules and the *_spv.h headers that aurora_vulkan.c includes.
+# Run it before building; glslc and spirv-val come with the Vulkan SDK.
+set -e
+cd "$(dirname "$0")"
 glslc shader.vert -o vert.spv
 glslc shader.frag -o frag.spv
+glslc shader_instanced.vert -o instanced_vert.spv
+spirv-val vert.spv
+spirv-val frag.spv
+spirv-val instanced_vert.spv
+sh embed.sh vert_spv vert.spv > vert_spv.h
+sh embed.sh frag_spv frag.spv > frag_spv.h
+sh embed.sh instanced_vert_spv instanced_vert.spv > instanced_vert_spv.h
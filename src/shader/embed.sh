@@ -0,0 +1,9 @@
+#!/bin/sh
+# embed.sh <name> <module.spv> > <name>.h
+# Prints the module as a uint32_t array, so it is word aligned and can be handed to vkCreateShaderModule as is.
+echo "// generated by embed.sh from $2, do not edit"
+echo "#include <stdint.h>"
+echo ""
+echo "static const uint32_t $1[] = {"
+od -An -v -tx4 "$2" | sed -e 's/ *\([0-9a-f]\{8\}\)/0x\1, /g' -e 's/, $/,/' -e 's/^/\t/'
+echo "};"
@@ -1,10 +1,10 @@
 #version 450
 
-layout(binding = 0) uniform UniformBufferObject {
-	mat4 model;
-	mat4 view;
-	mat4 proj;
-} ubo;
+// maps layout pixels to normalized device coordinates, so panning and zooming never touch the vertices
+layout(push_constant) uniform View {
+	vec2 scale;
+	vec2 offset;
+} view;
 
 layout(location = 0) in vec2 inPosition;
 layout(location = 1) in vec3 inColor;
@@ -12,6 +12,6 @@ layout(location = 1) in vec3 inColor;
 layout(location = 0) out vec3 fragColor;
 
 void main(){
-	gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 0.0, 1.0);
+	gl_Position = vec4(inPosition * view.scale + view.offset, 0.0, 1.0);
 	fragColor = inColor;
 }
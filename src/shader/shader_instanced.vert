@@ -0,0 +1,26 @@
+#version 450
+
+layout(push_constant) uniform View {
+	vec2 scale;
+	vec2 offset;
+} view;
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec2 inSize;
+layout(location = 2) in vec3 inColor;
+
+layout(location = 0) out vec3 fragColor;
+
+const vec3 cornerColors[4] = vec3[](
+	vec3(1.0, 0.0, 0.0),
+	vec3(0.0, 1.0, 0.0),
+	vec3(0.0, 0.0, 1.0),
+	vec3(1.0, 1.0, 0.0)
+);
+
+void main(){
+	// 0 = top left, 1 = top right, 2 = bottom left, 3 = bottom right
+	vec2 corner = vec2(gl_VertexIndex & 1, gl_VertexIndex >> 1);
+	gl_Position = vec4((inPosition + corner * inSize) * view.scale + view.offset, 0.0, 1.0);
+	fragColor = cornerColors[gl_VertexIndex] * inColor;
+}